@@ -0,0 +1,175 @@
+#include "bench.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <random>
+#include <thread>
+#include <vector>
+#include "errors.h"
+#include "netmask_int.h"
+#include "output.h"
+#include "radix.h"
+#include "trie.h"
+
+constexpr size_t bench_prefixes{ 1 << 18 };
+constexpr size_t bench_sort_prefixes{ 1 << 22 };
+constexpr size_t bench_threads[]{ 1, 2, 4, 8, 16, 32 };
+
+using bench_clock = std::chrono::steady_clock;
+
+static nm bench_input(const size_t count, std::mt19937_64& random)
+{
+	const nm self{ new tag_nm{} };
+	for (size_t i{}; i < count; i++)
+	{
+		const unsigned long long r{ random() };
+		if (r & 3)
+		{
+			const int length{ 20 + static_cast<int>(r >> 2 & 0xff) % 13 };
+			const uint128 key{ uint128_and(uint128_lit(0, 0x0000ffff00000000ULL | (r >> 32 & 0xffffffffULL)), uint128_cidr(static_cast<unsigned char>(96 + length))) };
+			nm_push(self, key, 96 + length, AF_INET);
+		}
+		else
+		{
+			const int length{ 48 + static_cast<int>(r >> 2 & 0xff) % 17 };
+			const uint128 key{ uint128_and(uint128_lit(0x20010db800000000ULL | (r >> 32 & 0xffffffffULL), 0), uint128_cidr(static_cast<unsigned char>(length))) };
+			nm_push(self, key, length, AF_INET6);
+		}
+	}
+	return self;
+}
+
+static bool bench_equal(const tag_nm* a, const tag_nm* b)
+{
+	if (!a || !b || a->keys.size() != b->keys.size() || a->lengths != b->lengths || a->families != b->families)
+		return false;
+	for (size_t i{}; i < a->keys.size(); i++)
+		if (uint128_cmp(a->keys[i], b->keys[i]) != 0)
+			return false;
+	return true;
+}
+
+static int bench_trie()
+{
+	std::mt19937_64 random{ 1 };
+	const nm all{ bench_input(bench_prefixes, random) };
+	const nm expected{ new tag_nm{ *all } };
+	nm_normalize(expected);
+	double base{};
+	int result{};
+	out_printf("%7s %10s %10s %8s %10s\n", "threads", "ms", "Mpfx/s", "speedup", "contended");
+	for (const size_t threads : bench_threads)
+	{
+		std::vector<nm> slices(threads);
+		for (size_t t{}; t < threads; t++)
+		{
+			slices[t] = new tag_nm{};
+			for (size_t i{ t }; i < all->keys.size(); i += threads)
+				nm_push(slices[t], all->keys[i], all->lengths[i], nm_domain(all, i));
+		}
+		const nm_trie trie{ nm_trie_new() };
+		std::vector<size_t> contended(threads);
+		std::vector<std::thread> workers;
+		const auto start{ bench_clock::now() };
+		for (size_t t{}; t < threads; t++)
+			workers.emplace_back([&, t] { contended[t] = nm_trie_insert(trie, slices[t]); });
+		for (std::thread& w : workers)
+			w.join();
+		const double ms{ std::chrono::duration<double, std::milli>(bench_clock::now() - start).count() };
+		size_t lost{};
+		for (size_t t{}; t < threads; t++)
+		{
+			lost += contended[t];
+			nm_free(slices[t]);
+		}
+		if (!base)
+			base = ms;
+		out_printf("%7zu %10.1f %10.2f %8.2f %10zu\n", threads, ms, static_cast<double>(bench_prefixes) / ms / 1000.0, base / ms, lost);
+		const nm snapshot{ nm_trie_snapshot(trie) };
+		if (!bench_equal(snapshot, expected))
+		{
+			warn("snapshot with %zu threads differs from the normalized input", threads);
+			result = 1;
+		}
+		for (size_t i{}; i < all->keys.size(); i++)
+		{
+			const in6_addr s6{ s6_of_u128(all->keys[i]) };
+			if (!nm_trie_contains(trie, &s6))
+			{
+				warn("trie with %zu threads lost an inserted prefix", threads);
+				result = 1;
+				break;
+			}
+		}
+		nm_free(snapshot);
+		nm_trie_free(trie);
+	}
+	out_printf("%zu prefixes normalize to %zu\n", all->keys.size(), expected->keys.size());
+	nm_free(all);
+	nm_free(expected);
+	out_flush();
+	return result;
+}
+
+static double bench_sort_run(const std::vector<nm_sort_item>& input, std::vector<nm_sort_item>* out, const unsigned threads)
+{
+	*out = input;
+	const auto start{ bench_clock::now() };
+	if (threads)
+		nm_radix_sort(out->data(), out->size(), threads);
+	else
+		std::sort(out->begin(), out->end(), [](const nm_sort_item& a, const nm_sort_item& b)
+		{
+			const int cmp{ uint128_cmp(a.key, b.key) };
+			return cmp < 0 || (cmp == 0 && a.length < b.length);
+		});
+	return std::chrono::duration<double, std::milli>(bench_clock::now() - start).count();
+}
+
+static int bench_sort()
+{
+	std::mt19937_64 random{ 1 };
+	const nm all{ bench_input(bench_sort_prefixes, random) };
+	std::vector<nm_sort_item> inputs[2];
+	for (size_t i{}; i < all->keys.size(); i++)
+	{
+		const nm_sort_item item{ all->keys[i], all->lengths[i], all->families[i] };
+		inputs[0].push_back(item);
+		if (!item.v6)
+			inputs[1].push_back(item);
+	}
+	nm_free(all);
+	int result{};
+	out_printf("%-6s %7s %10s %10s %8s\n", "input", "threads", "ms", "Mpfx/s", "speedup");
+	for (size_t k{}; k < 2; k++)
+	{
+		const char* name{ k ? "ipv4" : "mixed" };
+		std::vector<nm_sort_item> expected, sorted;
+		const double base{ bench_sort_run(inputs[k], &expected, 0) };
+		out_printf("%-6s %7s %10.1f %10.2f %8.2f\n", name, "std", base, static_cast<double>(inputs[k].size()) / base / 1000.0, 1.0);
+		for (const size_t threads : bench_threads)
+		{
+			const double ms{ bench_sort_run(inputs[k], &sorted, static_cast<unsigned>(threads)) };
+			out_printf("%-6s %7zu %10.1f %10.2f %8.2f\n", name, threads, ms, static_cast<double>(inputs[k].size()) / ms / 1000.0, base / ms);
+			for (size_t i{}; i < sorted.size(); i++)
+				if (uint128_cmp(sorted[i].key, expected[i].key) != 0 || sorted[i].length != expected[i].length)
+				{
+					warn("radix sort with %zu threads differs from std::sort at %zu", threads, i);
+					result = 1;
+					break;
+				}
+		}
+	}
+	out_flush();
+	return result;
+}
+
+int nm_benchmark(const char* name)
+{
+	if (strcmp(name, "trie") == 0)
+		return bench_trie();
+	if (strcmp(name, "sort") == 0)
+		return bench_sort();
+	warn("unknown benchmark \"%s\"", name);
+	return 1;
+}
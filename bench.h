@@ -0,0 +1,3 @@
+#pragma once
+
+int nm_benchmark(const char* name);
@@ -0,0 +1,302 @@
+#include "csv.h"
+#include <cstring>
+#include <string>
+#include <vector>
+#include "errors.h"
+#include "netmask_int.h"
+
+constexpr size_t csv_unresolved{ ~static_cast<size_t>(0) };
+
+struct csv_column
+{
+	std::string name;
+	size_t index;
+};
+
+struct csv_field
+{
+	const char* data;
+	size_t length;
+};
+
+struct tag_nm_csv
+{
+	std::vector<csv_column> columns;
+	std::vector<nm_filter> filters;
+	std::vector<csv_column> filter_columns;
+	bool named;
+};
+
+struct csv_reader
+{
+	const tag_nm_csv* csv;
+	const char* path;
+	nm result;
+	std::vector<csv_field> fields;
+	std::string unescaped;
+	std::vector<size_t> columns;
+	std::vector<size_t> filter_columns;
+	size_t line;
+	size_t inputs;
+	size_t first;
+};
+
+static csv_column csv_column_of(const std::string& name)
+{
+	char* end{};
+	const unsigned long index{ strtoul(name.c_str(), &end, 10) };
+	if (!name.empty() && *end == '\0' && index > 0)
+		return csv_column{ name, index - 1 };
+	return csv_column{ name, csv_unresolved };
+}
+
+nm_csv nm_csv_new(const char* columns, const nm_filter* filters, const size_t count)
+{
+	const auto self{ new tag_nm_csv{} };
+	for (const char* p{ columns };;)
+	{
+		const char* comma{ strchr(p, ',') };
+		const std::string name{ p, comma ? static_cast<size_t>(comma - p) : strlen(p) };
+		if (name.empty() || self->columns.size() == 2)
+		{
+			delete self;
+			return nullptr;
+		}
+		self->columns.push_back(csv_column_of(name));
+		self->named |= self->columns.back().index == csv_unresolved;
+		if (!comma)
+			break;
+		p = comma + 1;
+	}
+	for (size_t i{}; i < count; i++)
+	{
+		self->filters.push_back(filters[i]);
+		self->filter_columns.push_back(csv_column_of(filters[i].field));
+		self->named |= self->filter_columns.back().index == csv_unresolved;
+	}
+	return self;
+}
+
+void nm_csv_free(const nm_csv self)
+{
+	delete self;
+}
+
+static void csv_split(csv_reader& r, const char* p, const char* end)
+{
+	r.fields.clear();
+	r.unescaped.clear();
+	r.unescaped.reserve(static_cast<size_t>(end - p));
+	for (;;)
+	{
+		csv_field f{ p, 0 };
+		if (p < end && *p == '"')
+		{
+			f.data = ++p;
+			bool escaped{};
+			while (p < end && !(*p == '"' && (p + 1 == end || p[1] != '"')))
+			{
+				escaped |= *p == '"';
+				p += *p == '"' ? 2 : 1;
+			}
+			f.length = static_cast<size_t>(p - f.data);
+			if (escaped)
+			{
+				const size_t at{ r.unescaped.size() };
+				for (const char* q{ f.data }; q < p; q += *q == '"' ? 2 : 1)
+					r.unescaped.push_back(*q);
+				f.data = r.unescaped.data() + at;
+				f.length = r.unescaped.size() - at;
+			}
+			const auto comma{ static_cast<const char*>(memchr(p, ',', static_cast<size_t>(end - p))) };
+			p = comma ? comma : end;
+		}
+		else
+		{
+			const auto comma{ static_cast<const char*>(memchr(p, ',', static_cast<size_t>(end - p))) };
+			p = comma ? comma : end;
+			f.length = static_cast<size_t>(p - f.data);
+		}
+		r.fields.push_back(f);
+		if (p == end)
+			break;
+		p++;
+	}
+}
+
+static bool csv_decimal(const csv_field& f, uint128* value)
+{
+	uint128 v{};
+	for (size_t i{}; i < f.length; i++)
+	{
+		const unsigned digit{ static_cast<unsigned>(f.data[i] - '0') };
+		if (digit > 9 || v.h > 0x1999999999999999ULL)
+			return false;
+		bool carry{}, more{};
+		const uint128 twice{ uint128_lsh(v) };
+		v = uint128_add(uint128_lsh(uint128_lsh(twice)), twice, &carry);
+		v = uint128_add(v, uint128_lit(0, digit), &more);
+		if (carry || more)
+			return false;
+	}
+	*value = v;
+	return f.length > 0;
+}
+
+static void csv_map(uint128* v)
+{
+	v->l |= 0x0000ffff00000000ULL;
+}
+
+static bool csv_address(const csv_field& f, uint128* low, uint128* high, bool* v6, bool* numeric)
+{
+	char buf[64]{};
+	if (!f.length || f.length >= sizeof buf)
+		return false;
+	if ((*numeric = csv_decimal(f, low)))
+	{
+		*v6 = low->h || low->l > 0xffffffffULL;
+		*high = *low;
+		return true;
+	}
+	memcpy(buf, f.data, f.length);
+	char* slash{ strchr(buf, '/') };
+	if (slash)
+		*slash++ = '\0';
+	in6_addr s6{};
+	in_addr s{};
+	int length{ 128 };
+	if (inet_pton(AF_INET, buf, &s) == 1)
+	{
+		*low = uint128_lit(0, 0x0000ffff00000000ULL | ntohl(s.s_addr));
+		*v6 = false;
+	}
+	else if (inet_pton(AF_INET6, buf, &s6) == 1)
+	{
+		*low = uint128_of_s6(&s6);
+		*v6 = true;
+	}
+	else
+		return false;
+	if (slash)
+	{
+		char* end{};
+		const unsigned long bits{ strtoul(slash, &end, 10) };
+		if (end == slash || *end != '\0' || bits > (*v6 ? 128UL : 32UL))
+			return false;
+		length = static_cast<int>(*v6 ? bits : bits + 96);
+	}
+	const uint128 mask{ uint128_cidr(static_cast<unsigned char>(length)) };
+	*low = uint128_and(*low, mask);
+	*high = uint128_or(*low, uint128_neg(mask));
+	return true;
+}
+
+static void csv_resolve(csv_reader& r)
+{
+	const auto find{ [&r](const csv_column& c)
+	{
+		if (c.index != csv_unresolved)
+			return c.index;
+		for (size_t i{}; i < r.fields.size(); i++)
+			if (r.fields[i].length == c.name.size() && memcmp(r.fields[i].data, c.name.data(), c.name.size()) == 0)
+				return i;
+		panic("%s: no column named \"%s\"", r.path, c.name.c_str());
+		return csv_unresolved;
+	} };
+	for (const csv_column& c : r.csv->columns)
+		r.columns.push_back(find(c));
+	for (const csv_column& c : r.csv->filter_columns)
+		r.filter_columns.push_back(find(c));
+}
+
+static void csv_line(csv_reader& r, const char* p, const char* end)
+{
+	r.line++;
+	if (end > p && end[-1] == '\r')
+		end--;
+	if (p == end)
+		return;
+	csv_split(r, p, end);
+	if (r.columns.empty())
+	{
+		csv_resolve(r);
+		if (r.csv->named)
+			return;
+		r.first = r.line;
+	}
+	for (size_t i{}; i < r.filter_columns.size(); i++)
+	{
+		const size_t column{ r.filter_columns[i] };
+		if (column >= r.fields.size() || !nm_filter_match(r.csv->filters[i], r.fields[column].data, r.fields[column].length))
+			return;
+	}
+	uint128 low{}, high{}, last{}, ignored{};
+	bool v6{}, last_v6{}, numeric{}, last_numeric{};
+	const size_t start{ r.columns[0] };
+	const size_t stop{ r.columns.size() > 1 ? r.columns[1] : start };
+	if (start >= r.fields.size() || stop >= r.fields.size() || !csv_address(r.fields[start], &low, &high, &v6, &numeric) ||
+		(stop != start && !csv_address(r.fields[stop], &ignored, &last, &last_v6, &last_numeric)))
+	{
+		if (r.line != r.first)
+			warn("%s:%zu: no address in the selected columns", r.path, r.line);
+		return;
+	}
+	v6 |= last_v6;
+	if (numeric && !v6)
+	{
+		csv_map(&low);
+		csv_map(&high);
+	}
+	if (last_numeric && !v6)
+		csv_map(&last);
+	if (stop != start)
+	{
+		if (uint128_cmp(low, last) > 0)
+		{
+			warn("%s:%zu: range starts after it ends", r.path, r.line);
+			return;
+		}
+		high = last;
+	}
+	nm_range(r.result, low, high, v6 ? AF_INET6 : AF_INET);
+	r.inputs++;
+}
+
+nm nm_csv_read(const nm_csv self, const nm_input in, const char* path, size_t* inputs)
+{
+	csv_reader r{ .csv = self, .path = path, .result = new tag_nm{} };
+	std::string carry;
+	const char* data{};
+	for (size_t n; (n = input_read(in, &data));)
+	{
+		const char* p{ data };
+		const char* end{ data + n };
+		if (!carry.empty())
+		{
+			const auto newline{ static_cast<const char*>(memchr(p, '\n', n)) };
+			if (!newline)
+			{
+				carry.append(p, n);
+				continue;
+			}
+			carry.append(p, newline);
+			csv_line(r, carry.data(), carry.data() + carry.size());
+			carry.clear();
+			p = newline + 1;
+		}
+		for (const char* newline; (newline = static_cast<const char*>(memchr(p, '\n', static_cast<size_t>(end - p)))); p = newline + 1)
+			csv_line(r, p, newline);
+		carry.assign(p, end);
+	}
+	if (!carry.empty())
+		csv_line(r, carry.data(), carry.data() + carry.size());
+	*inputs = r.inputs;
+	status("%s: %zu of %zu lines matched", path, r.inputs, r.line);
+	if (r.result->keys.empty())
+	{
+		nm_free(r.result);
+		return nullptr;
+	}
+	return r.result;
+}
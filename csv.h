@@ -0,0 +1,10 @@
+#pragma once
+#include <cstddef>
+#include "filter.h"
+#include "input.h"
+#include "netmask.h"
+
+using nm_csv = struct tag_nm_csv*;
+nm_csv nm_csv_new(const char* columns, const nm_filter*, size_t);
+nm nm_csv_read(nm_csv, nm_input, const char* path, size_t* inputs);
+void nm_csv_free(nm_csv);
@@ -0,0 +1,198 @@
+#include "daemon.h"
+#include <afunix.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "errors.h"
+#include "nmset.h"
+#include "output.h"
+
+constexpr size_t daemon_line_max{ 1 << 20 };
+constexpr size_t daemon_backlog{ 1 << 20 };
+
+struct client
+{
+	SOCKET fd;
+	std::string pending;
+	std::string output;
+	bool waiting;
+	bool closing;
+};
+
+static void (*display_p)(int, const nm_address*, nm_address*) {};
+
+static int command(const nm_set set, char* line, const int flags)
+{
+	char* context{};
+	const char* word{ strtok_s(line, " \t\r", &context) };
+	if (!word)
+		return 1;
+	if (strcmp(word, "add") == 0 || strcmp(word, "remove") == 0)
+	{
+		const bool add{ word[0] == 'a' };
+		const char* bad{};
+		while ((word = strtok_s(nullptr, " \t\r", &context)))
+		{
+			if (const nm n{ nm_new_str(word, flags) })
+				add ? nm_set_add(set, n) : nm_set_remove(set, n);
+			else if (!bad)
+				bad = word;
+		}
+		if (bad)
+			out_printf("error parse error \"%s\"\n", bad);
+		else
+			out_printf("ok %zu\n", nm_set_size(set));
+	}
+	else if (strcmp(word, "query") == 0)
+	{
+		while ((word = strtok_s(nullptr, " \t\r", &context)))
+		{
+			out_printf("%s ", word);
+			const nm n{ nm_new_str(word, flags) };
+			if (!n || !nm_set_lookup(set, n, display_p))
+				out_write("-\n", 2);
+			nm_free(n);
+		}
+		out_write("ok\n", 3);
+	}
+	else if (strcmp(word, "dump") == 0)
+	{
+		nm_set_walk(set, display_p);
+		out_printf("ok %zu\n", nm_set_size(set));
+	}
+	else if (strcmp(word, "quit") == 0)
+		return 0;
+	else if (strcmp(word, "shutdown") == 0)
+		return -1;
+	else
+		out_printf("error unknown command \"%s\"\n", word);
+	return 1;
+}
+
+static int serve(const nm_set set, client& c, out_buffer* buffer, const int flags)
+{
+	int keep{ 1 };
+	size_t start{}, end;
+	while (keep > 0 && c.output.size() < daemon_backlog && (end = c.pending.find('\n', start)) != std::string::npos)
+	{
+		c.pending[end] = '\0';
+		keep = command(set, c.pending.data() + start, flags);
+		start = end + 1;
+		c.output.append(buffer->data, buffer->length);
+		buffer->length = 0;
+	}
+	c.pending.erase(0, keep > 0 ? start : c.pending.size());
+	c.closing |= keep <= 0;
+	c.waiting = c.pending.find('\n') != std::string::npos;
+	const size_t line{ c.pending.rfind('\n') };
+	if (c.pending.size() - (line == std::string::npos ? 0 : line + 1) > daemon_line_max)
+	{
+		errno = 0;
+		warn("dropping a client that sent a line longer than %zu bytes", daemon_line_max);
+		return 0;
+	}
+	return keep < 0 ? -1 : 1;
+}
+
+static int transmit(client& c)
+{
+	size_t sent{};
+	while (sent < c.output.size())
+	{
+		const int n{ send(c.fd, c.output.data() + sent, static_cast<int>(std::min<size_t>(c.output.size() - sent, 1 << 30)), 0) };
+		if (n == SOCKET_ERROR && WSAGetLastError() == WSAEWOULDBLOCK)
+			break;
+		if (n <= 0)
+			return 0;
+		sent += n;
+	}
+	c.output.erase(0, sent);
+	return !c.closing || c.waiting || !c.output.empty();
+}
+
+int nm_daemon(const char* path, const nm self, const int flags, void (*cb)(int, const nm_address*, nm_address*))
+{
+	WSADATA wsa{};
+	sockaddr_un address{ .sun_family = AF_UNIX };
+	if (strlen(path) >= sizeof address.sun_path)
+		panic("socket path too long \"%s\"", path);
+	strcpy_s(address.sun_path, path);
+	if (WSAStartup(MAKEWORD(2, 2), &wsa) != 0)
+		panic("WSAStartup failed");
+	const SOCKET listener{ socket(AF_UNIX, SOCK_STREAM, 0) };
+	if (listener == INVALID_SOCKET)
+		panic("failed to create socket");
+	[[maybe_unused]] int result{ remove(path) };
+	if (bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof address) == SOCKET_ERROR || listen(listener, SOMAXCONN) == SOCKET_ERROR)
+		panic("failed to listen on \"%s\"", path);
+	display_p = cb;
+	const nm_set set{ nm_set_new(self) };
+	status("serving %zu prefixes on %s", nm_set_size(set), path);
+	out_buffer buffer{};
+	out_buffer* previous{ out_select(&buffer) };
+	std::vector<client> clients;
+	std::vector<WSAPOLLFD> fds;
+	int running{ 1 };
+	while (running)
+	{
+		fds.assign(1, WSAPOLLFD{ listener, POLLIN, 0 });
+		for (const client& c : clients)
+			fds.push_back(WSAPOLLFD{ c.fd, static_cast<SHORT>((c.closing || c.waiting ? 0 : POLLIN) | (c.output.empty() ? 0 : POLLOUT)), 0 });
+		if (WSAPoll(fds.data(), static_cast<ULONG>(fds.size()), -1) == SOCKET_ERROR)
+			panic("poll failed");
+		for (size_t i{ fds.size() - 1 }; i > 0; i--)
+		{
+			if (!fds[i].revents)
+				continue;
+			client& c{ clients[i - 1] };
+			int keep{};
+			if (fds[i].revents & ~POLLOUT && !c.closing)
+			{
+				char chunk[65536];
+				const int n{ recv(c.fd, chunk, sizeof chunk, 0) };
+				if (n > 0)
+					c.pending.append(chunk, n);
+				else if (n == 0 || WSAGetLastError() != WSAEWOULDBLOCK)
+					c.closing = true;
+			}
+			do
+			{
+				if ((keep = serve(set, c, &buffer, flags)) < 0)
+					running = 0;
+				if (keep && !transmit(c))
+					keep = 0;
+			} while (keep > 0 && c.waiting && c.output.size() < daemon_backlog);
+			if (!keep)
+			{
+				closesocket(c.fd);
+				clients.erase(clients.begin() + static_cast<std::ptrdiff_t>(i - 1));
+			}
+		}
+		if (fds[0].revents & POLLIN)
+		{
+			u_long nonblocking{ 1 };
+			const SOCKET fd{ accept(listener, nullptr, nullptr) };
+			if (fd == INVALID_SOCKET)
+				warn("accept failed");
+			else if (ioctlsocket(fd, FIONBIO, &nonblocking) == SOCKET_ERROR)
+			{
+				warn("failed to make a client socket non-blocking");
+				closesocket(fd);
+			}
+			else
+				clients.push_back(client{ fd });
+		}
+	}
+	for (const client& c : clients)
+		closesocket(c.fd);
+	closesocket(listener);
+	result = remove(path);
+	out_select(previous);
+	out_release(&buffer);
+	nm_set_free(set);
+	WSACleanup();
+	return 0;
+}
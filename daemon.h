@@ -0,0 +1,4 @@
+#pragma once
+#include "netmask.h"
+
+int nm_daemon(const char* path, nm, int flags, void (*)(int, const nm_address*, nm_address*));
@@ -0,0 +1,221 @@
+#include "enumerate.h"
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <vector>
+#include "netmask_int.h"
+#include "output.h"
+
+#if defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__)
+#define NM_SSE2 1
+#include <emmintrin.h>
+#endif
+
+struct enumerate_tables
+{
+	char octet[256][4];
+	unsigned char octet_length[256];
+
+	constexpr enumerate_tables() : octet{}, octet_length{}
+	{
+		for (int i{}; i < 256; i++)
+		{
+			int n{};
+			if (i >= 100)
+				octet[i][n++] = static_cast<char>('0' + i / 100);
+			if (i >= 10)
+				octet[i][n++] = static_cast<char>('0' + i / 10 % 10);
+			octet[i][n++] = static_cast<char>('0' + i % 10);
+			octet_length[i] = static_cast<unsigned char>(n);
+		}
+	}
+};
+
+static constexpr enumerate_tables tables{};
+
+struct tag_nm_enumerator
+{
+	nm set;
+	std::vector<unsigned long long> ends;
+	nm_enumeration window;
+};
+
+static thread_local nm_enumeration* enumerate_current{};
+
+struct enumerate_prefix
+{
+	alignas(16) char text[48];
+	size_t length;
+};
+
+static void prefix_store(char* p, const enumerate_prefix& prefix)
+{
+#ifdef NM_SSE2
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(p), _mm_load_si128(reinterpret_cast<const __m128i*>(prefix.text)));
+	if (prefix.length > 16)
+	{
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(p + 16), _mm_load_si128(reinterpret_cast<const __m128i*>(prefix.text + 16)));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(p + 32), _mm_load_si128(reinterpret_cast<const __m128i*>(prefix.text + 32)));
+	}
+#else
+	memcpy(p, prefix.text, prefix.length > 16 ? sizeof prefix.text : 16);
+#endif
+}
+
+static void enumerate_v4(unsigned first, unsigned long long count)
+{
+	while (count)
+	{
+		const unsigned low{ first & 0xff };
+		const unsigned n{ static_cast<unsigned>(std::min<unsigned long long>(count, 256 - low)) };
+		enumerate_prefix prefix{};
+		for (int shift{ 24 }; shift > 0; shift -= 8)
+		{
+			const unsigned o{ first >> shift & 0xff };
+			memcpy(prefix.text + prefix.length, tables.octet[o], 4);
+			prefix.length += tables.octet_length[o];
+			prefix.text[prefix.length++] = '.';
+		}
+		char* p{ out_reserve(n * (prefix.length + 4) + sizeof prefix.text) };
+		for (unsigned i{ low }; i < low + n; i++)
+		{
+			prefix_store(p, prefix);
+			p += prefix.length;
+			memcpy(p, tables.octet[i], 4);
+			p += tables.octet_length[i];
+			*p++ = '\n';
+		}
+		out_commit(p);
+		first += n;
+		count -= n;
+	}
+}
+
+static void enumerate_text(const uint128& v, char* text)
+{
+	const in6_addr s6{ s6_of_u128(v) };
+	inet_ntop(AF_INET6, &s6, text, INET6_ADDRSTRLEN);
+}
+
+static bool enumerate_block(const uint128& v, enumerate_prefix* prefix)
+{
+	char low[INET6_ADDRSTRLEN + 1]{}, high[INET6_ADDRSTRLEN + 1]{};
+	enumerate_text(uint128_lit(v.h, (v.l & ~0xffffULL) | 1), low);
+	enumerate_text(uint128_lit(v.h, v.l | 0xffff), high);
+	const size_t n{ strlen(low) - 1 };
+	if (n < 1 || n >= sizeof prefix->text || low[n - 1] != ':' || low[n] != '1' || strncmp(low, high, n) != 0 || strcmp(high + n, "ffff") != 0)
+		return false;
+	memcpy(prefix->text, low, n);
+	prefix->length = n;
+	return true;
+}
+
+static void enumerate_v6(uint128 first, unsigned long long count)
+{
+	static constexpr char digits[]{ "0123456789abcdef" };
+	while (count)
+	{
+		const unsigned low{ static_cast<unsigned>(first.l & 0xffff) };
+		const unsigned n{ static_cast<unsigned>(std::min<unsigned long long>(count, 0x10000 - low)) };
+		enumerate_prefix prefix{};
+		if (low == 0 || !enumerate_block(first, &prefix))
+		{
+			char* p{ out_reserve(INET6_ADDRSTRLEN + 1) };
+			enumerate_text(first, p);
+			p += strlen(p);
+			*p++ = '\n';
+			out_commit(p);
+			first = uint128_add(first, uint128_lit(0, 1), nullptr);
+			count--;
+			continue;
+		}
+		char* p{ out_reserve(n * (prefix.length + 5) + sizeof prefix.text) };
+		for (unsigned i{ low }; i < low + n; i++)
+		{
+			const int width{ (std::bit_width(i) + 3) / 4 };
+			const char hex[8]{ digits[i >> 12], digits[i >> 8 & 0xf], digits[i >> 4 & 0xf], digits[i & 0xf], '\n' };
+			prefix_store(p, prefix);
+			p += prefix.length;
+			memcpy(p, hex + 4 - width, 5);
+			p += width + 1;
+		}
+		out_commit(p);
+		first = uint128_add(first, uint128_lit(0, n), nullptr);
+		count -= n;
+	}
+}
+
+void nm_enumerate(nm_enumeration* self, const int domain, const nm_address* n, const nm_address* m)
+{
+	if (!self->limit)
+		return;
+	int bits{};
+	if (domain == AF_INET)
+		bits = std::countr_zero(static_cast<unsigned long long>(ntohl(m->s.s_addr)) | 1ULL << 32);
+	else
+	{
+		const uint128 mask{ uint128_of_s6(&m->s6) };
+		bits = mask.l ? std::countr_zero(mask.l) : mask.h ? 64 + std::countr_zero(mask.h) : 128;
+	}
+	unsigned long long count{ self->limit };
+	if (bits < 64)
+	{
+		const unsigned long long size{ 1ULL << bits };
+		if (self->offset >= size)
+		{
+			self->offset -= size;
+			return;
+		}
+		count = std::min(count, size - self->offset);
+	}
+	if (domain == AF_INET)
+		enumerate_v4(ntohl(n->s.s_addr) + static_cast<unsigned>(self->offset), count);
+	else
+		enumerate_v6(uint128_add(uint128_of_s6(&n->s6), uint128_lit(0, self->offset), nullptr), count);
+	self->offset = 0;
+	self->limit -= count;
+}
+
+static void enumerate_visit(const int domain, const nm_address* n, nm_address* m)
+{
+	nm_enumerate(enumerate_current, domain, n, m);
+}
+
+nm_enumerator nm_enumerator_new(const nm set, const nm_enumeration* window)
+{
+	const nm_enumerator self{ new tag_nm_enumerator{ .set = set, .window = *window } };
+	const size_t count{ nm_size(set) };
+	self->ends.reserve(count);
+	unsigned long long end{};
+	for (size_t i{}; i < count; i++)
+	{
+		const int bits{ 128 - set->lengths[i] };
+		const unsigned long long size{ bits < 64 ? 1ULL << bits : ~0ULL };
+		end = end > ~0ULL - size ? ~0ULL : end + size;
+		self->ends.push_back(end);
+	}
+	const unsigned long long total{ self->ends.empty() ? 0 : self->ends.back() };
+	self->window.limit = self->window.offset < total ? std::min(self->window.limit, total - self->window.offset) : 0;
+	return self;
+}
+
+unsigned long long nm_enumerator_size(const nm_enumerator self)
+{
+	return self->window.limit;
+}
+
+void nm_enumerator_write(const nm_enumerator self, const unsigned long long first, const unsigned long long count)
+{
+	const unsigned long long position{ self->window.offset + first };
+	size_t i{ static_cast<size_t>(std::upper_bound(self->ends.begin(), self->ends.end(), position) - self->ends.begin()) };
+	nm_enumeration state{ position - (i ? self->ends[i - 1] : 0), count };
+	enumerate_current = &state;
+	for (; i < self->ends.size() && state.limit; i++)
+		nm_visit(self->set->keys[i], self->set->lengths[i], nm_domain(self->set, i), enumerate_visit);
+	enumerate_current = nullptr;
+}
+
+void nm_enumerator_free(const nm_enumerator self)
+{
+	delete self;
+}
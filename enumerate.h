@@ -0,0 +1,16 @@
+#pragma once
+#include "netmask.h"
+
+struct nm_enumeration
+{
+	unsigned long long offset;
+	unsigned long long limit;
+};
+
+void nm_enumerate(nm_enumeration*, int domain, const nm_address* n, const nm_address* m);
+
+using nm_enumerator = struct tag_nm_enumerator*;
+nm_enumerator nm_enumerator_new(nm, const nm_enumeration*);
+unsigned long long nm_enumerator_size(nm_enumerator);
+void nm_enumerator_write(nm_enumerator, unsigned long long first, unsigned long long count);
+void nm_enumerator_free(nm_enumerator);
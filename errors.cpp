@@ -31,7 +31,9 @@ int init_errors(char* pn, int type, const int stat)
 
 int status(const char* fmt, ...)
 {
-	static char buf[1024]{};
+	static thread_local char buf[1024]{};
+	if (!show_status)
+		return 0;
 	va_list args;
 	va_start(args, fmt);
 	[[maybe_unused]] int result{ vsnprintf_s(buf, sizeof buf, fmt, args) };
@@ -41,7 +43,7 @@ int status(const char* fmt, ...)
 
 int warn(const char* fmt, ...)
 {
-	static char buf[1024]{};
+	static thread_local char buf[1024]{};
 	va_list args;
 	va_start(args, fmt);
 	[[maybe_unused]] int result{ vsnprintf_s(buf, sizeof buf, fmt, args) };
@@ -51,7 +53,7 @@ int warn(const char* fmt, ...)
 
 int panic(const char* fmt, ...)
 {
-	static char buf[1024];
+	static thread_local char buf[1024];
 	va_list args;
 	va_start(args, fmt);
 	[[maybe_unused]] int result{ vsnprintf_s(buf, sizeof buf, fmt, args) };
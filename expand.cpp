@@ -0,0 +1,418 @@
+#include "expand.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <numeric>
+#include <string>
+#include <thread>
+#include <vector>
+#include "errors.h"
+#include "netmask_int.h"
+
+constexpr size_t expand_batch_specs{ 4096 };
+constexpr size_t expand_backlog{ 8 };
+constexpr size_t expand_block_prefixes{ 4096 };
+constexpr size_t expand_ring_size{ 8 };
+constexpr int expand_spins{ 64 };
+
+using expand_clock = std::chrono::steady_clock;
+
+struct expand_batch
+{
+	std::string specs;
+	size_t count;
+};
+
+struct expand_block
+{
+	uint128 keys[expand_block_prefixes];
+	unsigned char lengths[expand_block_prefixes];
+	bool families[expand_block_prefixes];
+	size_t count;
+};
+
+struct expand_ring
+{
+	expand_block* cells[expand_ring_size];
+	alignas(64) std::atomic<size_t> head;
+	alignas(64) std::atomic<size_t> tail;
+};
+
+struct expand_worker
+{
+	std::mutex lock;
+	std::deque<expand_batch> tasks;
+	std::thread thread;
+	expand_block* block;
+	expand_ring blocks;
+	tag_nm scratch;
+	size_t inputs;
+	size_t prefixes;
+	double busy;
+};
+
+struct tag_nm_expand
+{
+	int flags;
+	std::vector<expand_worker> workers;
+	expand_worker caller;
+	expand_batch current;
+	size_t next;
+	std::mutex idle;
+	std::condition_variable wake;
+	std::condition_variable drained;
+	size_t queued;
+	bool closed;
+	std::thread aggregator;
+	std::atomic<size_t> parsing;
+	alignas(64) std::atomic<size_t> emitted;
+	std::vector<nm> levels;
+	size_t blocks;
+	size_t specs;
+	expand_clock::time_point start;
+	double read_idle;
+	double aggregate_busy;
+};
+
+static double expand_since(const expand_clock::time_point& start)
+{
+	return std::chrono::duration<double>(expand_clock::now() - start).count();
+}
+
+static void expand_wait(const std::atomic<size_t>& event, const size_t seen, int* spins)
+{
+	if (++*spins < expand_spins)
+		std::this_thread::yield();
+	else
+		event.wait(seen, std::memory_order_acquire);
+}
+
+static bool ring_push(expand_ring& r, expand_block* block)
+{
+	const size_t head{ r.head.load(std::memory_order_relaxed) };
+	if (head - r.tail.load(std::memory_order_acquire) == expand_ring_size)
+		return false;
+	r.cells[head % expand_ring_size] = block;
+	r.head.store(head + 1, std::memory_order_release);
+	return true;
+}
+
+static expand_block* ring_pop(expand_ring& r)
+{
+	const size_t tail{ r.tail.load(std::memory_order_relaxed) };
+	if (tail == r.head.load(std::memory_order_acquire))
+		return nullptr;
+	expand_block* block{ r.cells[tail % expand_ring_size] };
+	r.tail.store(tail + 1, std::memory_order_release);
+	r.tail.notify_one();
+	return block;
+}
+
+static nm expand_join(const nm a, const nm b)
+{
+	const nm out{ new tag_nm{} };
+	out->keys.reserve(a->keys.size() + b->keys.size());
+	out->lengths.reserve(a->keys.size() + b->keys.size());
+	out->families.reserve(a->keys.size() + b->keys.size());
+	for (size_t i{}, j{}; i < a->keys.size() || j < b->keys.size();)
+	{
+		const int cmp{ i == a->keys.size() ? 1 : j == b->keys.size() ? -1 : uint128_cmp(a->keys[i], b->keys[j]) };
+		if (cmp < 0 || (cmp == 0 && a->lengths[i] <= b->lengths[j]))
+		{
+			nm_append(out, a->keys[i], a->lengths[i], a->families[i]);
+			i++;
+		}
+		else
+		{
+			nm_append(out, b->keys[j], b->lengths[j], b->families[j]);
+			j++;
+		}
+	}
+	out->normalized = true;
+	nm_free(a);
+	nm_free(b);
+	return out;
+}
+
+static void expand_fold(tag_nm_expand* self, const expand_block* block)
+{
+	const auto start{ expand_clock::now() };
+	std::vector<size_t> order(block->count);
+	std::iota(order.begin(), order.end(), static_cast<size_t>(0));
+	std::sort(order.begin(), order.end(), [block](const size_t a, const size_t b)
+	{
+		const int cmp{ uint128_cmp(block->keys[a], block->keys[b]) };
+		return cmp < 0 || (cmp == 0 && block->lengths[a] < block->lengths[b]);
+	});
+	nm cover{ new tag_nm{} };
+	for (const size_t i : order)
+		nm_append(cover, block->keys[i], block->lengths[i], block->families[i]);
+	cover->normalized = true;
+	while (!self->levels.empty() && self->levels.back()->keys.size() <= 2 * cover->keys.size())
+	{
+		cover = expand_join(self->levels.back(), cover);
+		self->levels.pop_back();
+	}
+	self->levels.push_back(cover);
+	self->blocks++;
+	self->aggregate_busy += expand_since(start);
+}
+
+static double expand_emit(tag_nm_expand* self, expand_worker& w)
+{
+	const auto start{ expand_clock::now() };
+	w.prefixes += w.block->count;
+	if (&w == &self->caller)
+	{
+		expand_fold(self, w.block);
+		w.block->count = 0;
+		return expand_since(start);
+	}
+	int spins{};
+	for (;;)
+	{
+		const size_t seen{ w.blocks.tail.load(std::memory_order_acquire) };
+		if (ring_push(w.blocks, w.block))
+			break;
+		expand_wait(w.blocks.tail, seen, &spins);
+	}
+	self->emitted.fetch_add(1, std::memory_order_release);
+	self->emitted.notify_one();
+	w.block = new expand_block{};
+	return spins ? expand_since(start) : 0.0;
+}
+
+static nm expand_spec(const tag_nm_expand* self, tag_nm* scratch, const char* p)
+{
+	nm_spec spec{};
+	const int rv{ nm_parse(p, &spec) };
+	if (rv == nm_parse_name && nm_use_dns & self->flags)
+		return nm_new_str(p, self->flags);
+	if (rv != nm_parse_ok)
+		return nullptr;
+	scratch->keys.clear();
+	scratch->lengths.clear();
+	scratch->families.clear();
+	nm_spec_push(scratch, spec);
+	return scratch;
+}
+
+static void expand_run(tag_nm_expand* self, expand_worker& w, const expand_batch& b)
+{
+	const auto start{ expand_clock::now() };
+	double waited{};
+	for (const char* p{ b.specs.data() }, *end{ p + b.specs.size() }; p < end; p += strlen(p) + 1)
+	{
+		const nm n{ expand_spec(self, &w.scratch, p) };
+		if (!n)
+		{
+			warn("parse error \"%s\"", p);
+			continue;
+		}
+		w.inputs++;
+		for (size_t i{}; i < n->keys.size(); i++)
+		{
+			w.block->keys[w.block->count] = n->keys[i];
+			w.block->lengths[w.block->count] = n->lengths[i];
+			w.block->families[w.block->count] = n->families[i];
+			if (++w.block->count == expand_block_prefixes)
+				waited += expand_emit(self, w);
+		}
+		if (n != &w.scratch)
+			nm_free(n);
+	}
+	w.busy += expand_since(start) - waited;
+}
+
+static bool expand_take(tag_nm_expand* self, const size_t index, expand_batch* b)
+{
+	const size_t n{ self->workers.size() };
+	for (size_t i{}; i < n; i++)
+	{
+		expand_worker& victim{ self->workers[(index + i) % n] };
+		std::lock_guard guard{ victim.lock };
+		if (victim.tasks.empty())
+			continue;
+		if (i)
+		{
+			*b = std::move(victim.tasks.back());
+			victim.tasks.pop_back();
+		}
+		else
+		{
+			*b = std::move(victim.tasks.front());
+			victim.tasks.pop_front();
+		}
+		return true;
+	}
+	return false;
+}
+
+static void expand_worker_main(tag_nm_expand* self, const size_t index)
+{
+	expand_worker& w{ self->workers[index] };
+	w.block = new expand_block{};
+	for (;;)
+	{
+		expand_batch b{};
+		if (expand_take(self, index, &b))
+		{
+			{
+				std::lock_guard guard{ self->idle };
+				self->queued--;
+			}
+			self->drained.notify_one();
+			expand_run(self, w, b);
+			continue;
+		}
+		std::unique_lock guard{ self->idle };
+		if (!self->queued && self->closed)
+			break;
+		self->wake.wait(guard, [self] { return self->queued || self->closed; });
+	}
+	if (w.block->count)
+		expand_emit(self, w);
+	delete w.block;
+	self->parsing.fetch_sub(1, std::memory_order_release);
+	self->emitted.fetch_add(1, std::memory_order_release);
+	self->emitted.notify_one();
+}
+
+static void expand_aggregator(tag_nm_expand* self)
+{
+	for (int spins{};;)
+	{
+		const size_t seen{ self->emitted.load(std::memory_order_acquire) };
+		const bool parsing{ self->parsing.load(std::memory_order_acquire) != 0 };
+		bool found{};
+		for (expand_worker& w : self->workers)
+			while (expand_block* block{ ring_pop(w.blocks) })
+			{
+				expand_fold(self, block);
+				delete block;
+				found = true;
+			}
+		if (found)
+			spins = 0;
+		else if (!parsing)
+			return;
+		else
+			expand_wait(self->emitted, seen, &spins);
+	}
+}
+
+static void expand_submit(const nm_expand self)
+{
+	if (self->workers.empty())
+	{
+		self->workers = std::vector<expand_worker>(std::thread::hardware_concurrency() - 1);
+		self->parsing.store(self->workers.size());
+		for (size_t i{}; i < self->workers.size(); i++)
+			self->workers[i].thread = std::thread{ expand_worker_main, self, i };
+		self->aggregator = std::thread{ expand_aggregator, self };
+		status("expanding with %zu workers", self->workers.size());
+	}
+	{
+		const auto start{ expand_clock::now() };
+		std::unique_lock guard{ self->idle };
+		if (self->queued >= expand_backlog * self->workers.size())
+		{
+			self->drained.wait(guard, [self] { return self->queued < expand_backlog * self->workers.size(); });
+			self->read_idle += expand_since(start);
+		}
+		self->queued++;
+	}
+	{
+		expand_worker& w{ self->workers[self->next++ % self->workers.size()] };
+		std::lock_guard guard{ w.lock };
+		w.tasks.push_back(std::move(self->current));
+	}
+	self->current = expand_batch{};
+	self->wake.notify_one();
+}
+
+nm_expand nm_expand_new(const int flags)
+{
+	const auto self{ new tag_nm_expand{} };
+	self->flags = flags;
+	self->caller.block = new expand_block{};
+	self->start = expand_clock::now();
+	return self;
+}
+
+void nm_expand_add(const nm_expand self, const char* spec)
+{
+	self->specs++;
+	self->current.specs.append(spec, strlen(spec) + 1);
+	if (++self->current.count < expand_batch_specs)
+		return;
+	if (std::thread::hardware_concurrency() > 1)
+		expand_submit(self);
+	else
+	{
+		expand_run(self, self->caller, self->current);
+		self->current = expand_batch{};
+	}
+}
+
+nm nm_expand_finish(const nm_expand self, size_t* inputs, nm_expand_stats* stats)
+{
+	const bool pooled{ !self->workers.empty() };
+	const double read_busy{ expand_since(self->start) - self->read_idle - (pooled ? 0.0 : self->caller.busy + self->aggregate_busy) };
+	if (pooled && self->current.count)
+		expand_submit(self);
+	else if (!pooled)
+	{
+		expand_run(self, self->caller, self->current);
+		if (self->caller.block->count)
+			expand_emit(self, self->caller);
+	}
+	{
+		std::lock_guard guard{ self->idle };
+		self->closed = true;
+	}
+	self->wake.notify_all();
+	*inputs = self->caller.inputs;
+	double parse_busy{ self->caller.busy };
+	size_t prefixes{ self->caller.prefixes };
+	for (expand_worker& w : self->workers)
+	{
+		w.thread.join();
+		*inputs += w.inputs;
+		parse_busy += w.busy;
+		prefixes += w.prefixes;
+	}
+	if (pooled)
+		self->aggregator.join();
+	const auto start{ expand_clock::now() };
+	nm result{};
+	for (; !self->levels.empty(); self->levels.pop_back())
+		result = result ? expand_join(self->levels.back(), result) : self->levels.back();
+	self->aggregate_busy += expand_since(start);
+	status("expanded %zu specs into %zu prefixes with %zu parsers", self->specs, prefixes, self->workers.size());
+	if (stats)
+	{
+		stats->wall += expand_since(self->start);
+		stats->threads[expand_read] = 1;
+		stats->threads[expand_parse] = pooled ? self->workers.size() : 1;
+		stats->threads[expand_aggregate] = 1;
+		stats->busy[expand_read] += read_busy;
+		stats->busy[expand_parse] += parse_busy;
+		stats->busy[expand_aggregate] += self->aggregate_busy;
+		stats->items[expand_read] += self->specs;
+		stats->items[expand_parse] += prefixes;
+		stats->items[expand_aggregate] += self->blocks;
+	}
+	delete self->caller.block;
+	delete self;
+	if (result && result->keys.empty())
+	{
+		nm_free(result);
+		return nullptr;
+	}
+	return result;
+}
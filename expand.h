@@ -0,0 +1,24 @@
+#pragma once
+#include <cstddef>
+#include "netmask.h"
+
+enum
+{
+	expand_read,
+	expand_parse,
+	expand_aggregate,
+	expand_stages
+};
+
+struct nm_expand_stats
+{
+	double wall;
+	double busy[expand_stages];
+	size_t threads[expand_stages];
+	size_t items[expand_stages];
+};
+
+using nm_expand = struct tag_nm_expand*;
+nm_expand nm_expand_new(int flags);
+void nm_expand_add(nm_expand, const char* spec);
+nm nm_expand_finish(nm_expand, size_t* inputs, nm_expand_stats*);
@@ -0,0 +1,33 @@
+#include "filter.h"
+#include <cstring>
+
+static std::string filter_trim(const char* begin, const char* end)
+{
+	while (begin < end && (*begin == ' ' || *begin == '\t'))
+		begin++;
+	while (end > begin && (end[-1] == ' ' || end[-1] == '\t'))
+		end--;
+	return std::string{ begin, static_cast<size_t>(end - begin) };
+}
+
+int nm_filter_parse(const char* expr, nm_filter* filter)
+{
+	const char* op{ strstr(expr, "==") };
+	filter->negate = false;
+	if (const char* ne{ strstr(expr, "!=") }; ne && (!op || ne < op))
+	{
+		op = ne;
+		filter->negate = true;
+	}
+	if (!op)
+		return 0;
+	filter->field = filter_trim(expr, op);
+	filter->value = filter_trim(op + 2, expr + strlen(expr));
+	return !filter->field.empty();
+}
+
+bool nm_filter_match(const nm_filter& filter, const char* text, const size_t length)
+{
+	const bool equal{ length == filter.value.size() && memcmp(text, filter.value.data(), length) == 0 };
+	return equal != filter.negate;
+}
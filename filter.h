@@ -0,0 +1,13 @@
+#pragma once
+#include <cstddef>
+#include <string>
+
+struct nm_filter
+{
+	std::string field;
+	std::string value;
+	bool negate;
+};
+
+int nm_filter_parse(const char* expr, nm_filter*);
+bool nm_filter_match(const nm_filter&, const char* text, size_t length);
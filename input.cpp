@@ -0,0 +1,642 @@
+#include "input.h"
+#include <cerrno>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <io.h>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <Windows.h>
+#include "errors.h"
+
+constexpr size_t input_block{ 1 << 20 };
+
+struct input_buffer
+{
+	char* data;
+	size_t length;
+	bool full;
+};
+
+struct tag_nm_input
+{
+	FILE* fp;
+	HANDLE process;
+	bool failed;
+	std::string path;
+	std::thread worker;
+	std::mutex lock;
+	std::condition_variable changed;
+	input_buffer buffers[2];
+	int produce;
+	int consume;
+	int held;
+	bool done;
+	bool stop;
+	unsigned char* raw;
+	size_t raw_length;
+	size_t raw_pos;
+	char* out;
+	char* out_end;
+	const char* cursor;
+	const char* end;
+	size_t line;
+	size_t token_line;
+};
+
+struct huffman
+{
+	short count[16];
+	short symbol[320];
+	unsigned short fast[1 << 10];
+};
+
+struct inflater
+{
+	tag_nm_input* in;
+	unsigned long long bits;
+	int count;
+	bool error;
+	unsigned crc;
+	unsigned size;
+	const char* mark;
+	unsigned wpos;
+	unsigned history;
+	unsigned char window[32768];
+	huffman lencode;
+	huffman distcode;
+};
+
+struct crc_table
+{
+	unsigned v[256];
+
+	constexpr crc_table() : v{}
+	{
+		for (unsigned i{}; i < 256; i++)
+		{
+			unsigned c{ i };
+			for (int k{}; k < 8; k++)
+				c = c & 1 ? 0xedb88320U ^ c >> 1 : c >> 1;
+			v[i] = c;
+		}
+	}
+};
+
+static constexpr crc_table crc32{};
+
+static constexpr unsigned short length_base[29]{ 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+static constexpr unsigned char length_extra[29]{ 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+static constexpr unsigned short dist_base[30]{ 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+static constexpr unsigned char dist_extra[30]{ 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+static bool produce_begin(tag_nm_input* in)
+{
+	std::unique_lock guard{ in->lock };
+	input_buffer& b{ in->buffers[in->produce] };
+	in->changed.wait(guard, [&] { return !b.full || in->stop; });
+	in->out = b.data;
+	in->out_end = b.data + input_block;
+	return !in->stop;
+}
+
+static bool produce_end(tag_nm_input* in)
+{
+	input_buffer& b{ in->buffers[in->produce] };
+	if (in->out == b.data)
+		return !in->stop;
+	{
+		std::lock_guard guard{ in->lock };
+		b.length = static_cast<size_t>(in->out - b.data);
+		b.full = true;
+		in->produce ^= 1;
+	}
+	in->changed.notify_all();
+	return produce_begin(in);
+}
+
+static bool raw_fill(tag_nm_input* in)
+{
+	in->raw_length = fread(in->raw, 1, input_block, in->fp);
+	in->raw_pos = 0;
+	return in->raw_length > 0;
+}
+
+static unsigned crc_update(unsigned crc, const char* p, const char* end)
+{
+	crc = ~crc;
+	while (p < end)
+		crc = crc32.v[(crc ^ static_cast<unsigned char>(*p++)) & 0xff] ^ crc >> 8;
+	return ~crc;
+}
+
+static void fill(inflater& z)
+{
+	tag_nm_input* in{ z.in };
+	while (z.count <= 56)
+	{
+		if (in->raw_pos == in->raw_length && !raw_fill(in))
+			return;
+		z.bits |= static_cast<unsigned long long>(in->raw[in->raw_pos++]) << z.count;
+		z.count += 8;
+	}
+}
+
+static unsigned bits(inflater& z, const int n)
+{
+	if (z.count < n)
+		fill(z);
+	if (z.count < n)
+	{
+		z.error = true;
+		return 0;
+	}
+	const unsigned v{ static_cast<unsigned>(z.bits & ((1ULL << n) - 1)) };
+	z.bits >>= n;
+	z.count -= n;
+	return v;
+}
+
+static bool build(huffman& h, const unsigned char* lengths, const int n)
+{
+	short offsets[16]{};
+	memset(h.count, 0, sizeof h.count);
+	memset(h.fast, 0, sizeof h.fast);
+	for (int i{}; i < n; i++)
+		h.count[lengths[i]]++;
+	int left{ 1 };
+	for (int len{ 1 }; len < 16; len++)
+	{
+		left <<= 1;
+		left -= h.count[len];
+		if (left < 0)
+			return false;
+	}
+	for (int len{ 1 }; len < 15; len++)
+		offsets[len + 1] = static_cast<short>(offsets[len] + h.count[len]);
+	for (int i{}; i < n; i++)
+		if (lengths[i])
+			h.symbol[offsets[lengths[i]]++] = static_cast<short>(i);
+	int code{}, index{};
+	for (int len{ 1 }; len <= 10; len++, code <<= 1)
+		for (int k{}; k < h.count[len]; k++, code++)
+		{
+			unsigned reversed{};
+			for (int b{}; b < len; b++)
+				reversed |= (code >> b & 1) << (len - 1 - b);
+			for (unsigned r{ reversed }; r < 1 << 10; r += 1 << len)
+				h.fast[r] = static_cast<unsigned short>(h.symbol[index] << 4 | len);
+			index++;
+		}
+	return true;
+}
+
+static int decode(inflater& z, const huffman& h)
+{
+	if (z.count < 15)
+		fill(z);
+	if (const unsigned short e{ h.fast[z.bits & 0x3ff] }; e && (e & 15) <= z.count)
+	{
+		z.bits >>= e & 15;
+		z.count -= e & 15;
+		return e >> 4;
+	}
+	int code{}, first{}, index{};
+	for (int len{ 1 }; len < 16; len++)
+	{
+		code |= static_cast<int>(bits(z, 1));
+		if (z.error)
+			return -1;
+		const int count{ h.count[len] };
+		if (code - count < first)
+			return h.symbol[index + (code - first)];
+		index += count;
+		first += count;
+		first <<= 1;
+		code <<= 1;
+	}
+	z.error = true;
+	return -1;
+}
+
+static bool put(inflater& z, const unsigned char c)
+{
+	tag_nm_input* in{ z.in };
+	z.window[z.wpos++ & 32767] = c;
+	if (z.history < 32768)
+		z.history++;
+	if (in->out == in->out_end)
+	{
+		z.crc = crc_update(z.crc, z.mark, in->out);
+		if (!produce_end(in))
+			return false;
+		z.mark = in->out;
+	}
+	*in->out++ = static_cast<char>(c);
+	z.size++;
+	return true;
+}
+
+static bool codes(inflater& z, const huffman& lencode, const huffman& distcode)
+{
+	for (;;)
+	{
+		int symbol{ decode(z, lencode) };
+		if (z.error)
+			return false;
+		if (symbol < 256)
+		{
+			if (!put(z, static_cast<unsigned char>(symbol)))
+				return false;
+			continue;
+		}
+		if (symbol == 256)
+			return true;
+		symbol -= 257;
+		if (symbol >= 29)
+			return false;
+		const unsigned length{ length_base[symbol] + bits(z, length_extra[symbol]) };
+		symbol = decode(z, distcode);
+		if (z.error || symbol >= 30)
+			return false;
+		const unsigned distance{ dist_base[symbol] + bits(z, dist_extra[symbol]) };
+		if (z.error || distance > z.history)
+			return false;
+		for (unsigned i{}; i < length; i++)
+			if (!put(z, z.window[(z.wpos - distance) & 32767]))
+				return false;
+	}
+}
+
+static bool stored(inflater& z)
+{
+	bits(z, z.count & 7);
+	const unsigned length{ bits(z, 16) };
+	if (bits(z, 16) != (~length & 0xffff) || z.error)
+		return false;
+	for (unsigned i{}; i < length; i++)
+	{
+		const unsigned char c{ static_cast<unsigned char>(bits(z, 8)) };
+		if (z.error || !put(z, c))
+			return false;
+	}
+	return true;
+}
+
+static bool fixed(inflater& z)
+{
+	static huffman lencode, distcode;
+	static std::once_flag once;
+	std::call_once(once, []
+	{
+		unsigned char lengths[288];
+		int i{};
+		for (; i < 144; i++)
+			lengths[i] = 8;
+		for (; i < 256; i++)
+			lengths[i] = 9;
+		for (; i < 280; i++)
+			lengths[i] = 7;
+		for (; i < 288; i++)
+			lengths[i] = 8;
+		build(lencode, lengths, 288);
+		memset(lengths, 5, 30);
+		build(distcode, lengths, 30);
+	});
+	return codes(z, lencode, distcode);
+}
+
+static bool dynamic(inflater& z)
+{
+	static constexpr unsigned char order[19]{ 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+	unsigned char lengths[320]{};
+	const unsigned nlen{ bits(z, 5) + 257 }, ndist{ bits(z, 5) + 1 }, ncode{ bits(z, 4) + 4 };
+	if (z.error || nlen > 286 || ndist > 30)
+		return false;
+	for (unsigned i{}; i < ncode; i++)
+		lengths[order[i]] = static_cast<unsigned char>(bits(z, 3));
+	if (z.error || !build(z.lencode, lengths, 19))
+		return false;
+	for (unsigned i{}; i < nlen + ndist;)
+	{
+		const int symbol{ decode(z, z.lencode) };
+		if (z.error)
+			return false;
+		if (symbol < 16)
+		{
+			lengths[i++] = static_cast<unsigned char>(symbol);
+			continue;
+		}
+		unsigned char length{};
+		unsigned repeat;
+		if (symbol == 16)
+		{
+			if (i == 0)
+				return false;
+			length = lengths[i - 1];
+			repeat = 3 + bits(z, 2);
+		}
+		else if (symbol == 17)
+			repeat = 3 + bits(z, 3);
+		else
+			repeat = 11 + bits(z, 7);
+		if (z.error || i + repeat > nlen + ndist)
+			return false;
+		while (repeat--)
+			lengths[i++] = length;
+	}
+	if (lengths[256] == 0)
+		return false;
+	return build(z.lencode, lengths, static_cast<int>(nlen)) && build(z.distcode, lengths + nlen, static_cast<int>(ndist)) && codes(z, z.lencode, z.distcode);
+}
+
+static bool gzip_member(inflater& z)
+{
+	if (bits(z, 8) != 0x1f || bits(z, 8) != 0x8b || bits(z, 8) != 8)
+		return false;
+	const unsigned flags{ bits(z, 8) };
+	for (int i{}; i < 6; i++)
+		bits(z, 8);
+	if (flags & 4)
+		for (unsigned extra{ bits(z, 16) }; extra && !z.error; extra--)
+			bits(z, 8);
+	if (flags & 8)
+		while (bits(z, 8) && !z.error)
+			;
+	if (flags & 16)
+		while (bits(z, 8) && !z.error)
+			;
+	if (flags & 2)
+		bits(z, 16);
+	z.crc = 0;
+	z.size = 0;
+	z.history = 0;
+	z.mark = z.in->out;
+	for (unsigned last{}; !last;)
+	{
+		last = bits(z, 1);
+		bool ok;
+		switch (bits(z, 2))
+		{
+		case 0:
+			ok = stored(z);
+			break;
+		case 1:
+			ok = fixed(z);
+			break;
+		case 2:
+			ok = dynamic(z);
+			break;
+		default:
+			ok = false;
+			break;
+		}
+		if (!ok || z.error)
+			return false;
+	}
+	z.crc = crc_update(z.crc, z.mark, z.in->out);
+	bits(z, z.count & 7);
+	const unsigned crc{ bits(z, 32) }, size{ bits(z, 32) };
+	return !z.error && crc == z.crc && size == z.size;
+}
+
+static void inflate_gzip(tag_nm_input* in)
+{
+	const auto z{ new inflater{ in } };
+	while (gzip_member(*z))
+	{
+		fill(*z);
+		if (z->count == 0)
+		{
+			delete z;
+			return;
+		}
+		if ((z->bits & 0xffff) != 0x8b1f)
+		{
+			warn("trailing garbage after gzip data in \"%s\"", in->path.c_str());
+			delete z;
+			return;
+		}
+	}
+	delete z;
+	std::lock_guard guard{ in->lock };
+	if (!in->stop)
+	{
+		warn("corrupt gzip data in \"%s\"", in->path.c_str());
+		in->failed = true;
+	}
+}
+
+static void copy_plain(tag_nm_input* in)
+{
+	do
+	{
+		for (size_t n; in->raw_pos < in->raw_length; in->raw_pos += n)
+		{
+			if (in->out == in->out_end && !produce_end(in))
+				return;
+			n = in->raw_length - in->raw_pos;
+			if (n > static_cast<size_t>(in->out_end - in->out))
+				n = static_cast<size_t>(in->out_end - in->out);
+			memcpy(in->out, in->raw + in->raw_pos, n);
+			in->out += n;
+		}
+	}
+	while (raw_fill(in));
+}
+
+static FILE* zstd_open(tag_nm_input* in)
+{
+	SECURITY_ATTRIBUTES inherit{ sizeof inherit, nullptr, TRUE };
+	HANDLE reader, writer;
+	if (!CreatePipe(&reader, &writer, &inherit, 0))
+	{
+		warn("failed to create a pipe for zstd");
+		in->failed = true;
+		return nullptr;
+	}
+	SetHandleInformation(reader, HANDLE_FLAG_INHERIT, 0);
+	STARTUPINFOA startup{ .cb = sizeof startup, .dwFlags = STARTF_USESTDHANDLES, .hStdInput = GetStdHandle(STD_INPUT_HANDLE), .hStdOutput = writer, .hStdError = GetStdHandle(STD_ERROR_HANDLE) };
+	PROCESS_INFORMATION info{};
+	std::string command{ "zstd -dcq -- \"" + in->path + "\"" };
+	const BOOL started{ CreateProcessA(nullptr, command.data(), nullptr, nullptr, TRUE, 0, nullptr, nullptr, &startup, &info) };
+	const DWORD error{ GetLastError() };
+	CloseHandle(writer);
+	if (!started)
+	{
+		CloseHandle(reader);
+		errno = 0;
+		if (error == ERROR_FILE_NOT_FOUND)
+			warn("zstd was not found on the PATH; it is needed to read \"%s\"", in->path.c_str());
+		else
+			warn("failed to run zstd for \"%s\" (error %lu)", in->path.c_str(), static_cast<unsigned long>(error));
+		in->failed = true;
+		return nullptr;
+	}
+	CloseHandle(info.hThread);
+	in->process = info.hProcess;
+	const int fd{ _open_osfhandle(reinterpret_cast<intptr_t>(reader), _O_RDONLY | _O_BINARY) };
+	if (fd < 0)
+	{
+		CloseHandle(reader);
+		in->failed = true;
+		return nullptr;
+	}
+	return _fdopen(fd, "rb");
+}
+
+static void zstd_finish(tag_nm_input* in)
+{
+	{
+		std::lock_guard guard{ in->lock };
+		if (in->stop)
+			return;
+	}
+	DWORD code{};
+	WaitForSingleObject(in->process, INFINITE);
+	if (!GetExitCodeProcess(in->process, &code) || code)
+	{
+		errno = 0;
+		warn("zstd failed to decompress \"%s\" (exit code %lu)", in->path.c_str(), static_cast<unsigned long>(code));
+		in->failed = true;
+	}
+}
+
+static void input_worker(tag_nm_input* in)
+{
+	if (produce_begin(in) && raw_fill(in))
+	{
+		if (in->raw_length >= 2 && in->raw[0] == 0x1f && in->raw[1] == 0x8b)
+			inflate_gzip(in);
+		else if (in->raw_length >= 4 && in->raw[0] == 0x28 && in->raw[1] == 0xb5 && in->raw[2] == 0x2f && in->raw[3] == 0xfd)
+		{
+			if (in->fp == stdin)
+			{
+				warn("zstd input is only supported from files, not stdin");
+				in->failed = true;
+			}
+			else
+			{
+				fclose(in->fp);
+				if ((in->fp = zstd_open(in)))
+				{
+					if (raw_fill(in))
+						copy_plain(in);
+					zstd_finish(in);
+				}
+			}
+		}
+		else
+			copy_plain(in);
+		produce_end(in);
+	}
+	{
+		std::lock_guard guard{ in->lock };
+		in->done = true;
+	}
+	in->changed.notify_all();
+}
+
+nm_input input_open(const char* path)
+{
+	FILE* fp{};
+	if (strcmp(path, "-") == 0)
+	{
+		fp = stdin;
+		[[maybe_unused]] int result{ _setmode(_fileno(stdin), _O_BINARY) };
+	}
+	else if (fopen_s(&fp, path, "rb") != 0)
+		return nullptr;
+	const auto in{ new tag_nm_input{ fp, nullptr, false, path } };
+	in->line = 1;
+	for (input_buffer& b : in->buffers)
+		b.data = new char[input_block];
+	in->raw = new unsigned char[input_block];
+	in->held = -1;
+	in->worker = std::thread{ input_worker, in };
+	return in;
+}
+
+size_t input_read(const nm_input in, const char** data)
+{
+	std::unique_lock guard{ in->lock };
+	if (in->held >= 0)
+	{
+		in->buffers[in->held].full = false;
+		in->held = -1;
+		in->changed.notify_all();
+	}
+	input_buffer& b{ in->buffers[in->consume] };
+	in->changed.wait(guard, [&] { return b.full || in->done; });
+	if (!b.full)
+		return 0;
+	in->held = in->consume;
+	in->consume ^= 1;
+	*data = b.data;
+	return b.length;
+}
+
+int input_token(const nm_input in, char* buf, const size_t size)
+{
+	size_t n{};
+	for (;;)
+	{
+		if (in->cursor == in->end)
+		{
+			const char* data{};
+			const size_t length{ input_read(in, &data) };
+			if (!length)
+				break;
+			in->cursor = data;
+			in->end = data + length;
+		}
+		const char c{ *in->cursor };
+		if (c == ' ' || (c >= '\t' && c <= '\r'))
+		{
+			if (n)
+				break;
+			if (c == '\n')
+				in->line++;
+			in->cursor++;
+			continue;
+		}
+		if (n + 1 == size)
+			break;
+		if (!n)
+			in->token_line = in->line;
+		buf[n++] = c;
+		in->cursor++;
+	}
+	buf[n] = '\0';
+	return n > 0;
+}
+
+size_t input_line(const nm_input in)
+{
+	return in->token_line;
+}
+
+int input_close(const nm_input in)
+{
+	{
+		std::lock_guard guard{ in->lock };
+		in->stop = true;
+	}
+	in->changed.notify_all();
+	in->worker.join();
+	if (in->fp && in->fp != stdin)
+		fclose(in->fp);
+	if (in->process)
+	{
+		WaitForSingleObject(in->process, INFINITE);
+		CloseHandle(in->process);
+	}
+	for (const input_buffer& b : in->buffers)
+		delete[] b.data;
+	delete[] in->raw;
+	const bool failed{ in->failed };
+	delete in;
+	return failed ? -1 : 0;
+}
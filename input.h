@@ -0,0 +1,9 @@
+#pragma once
+#include <cstddef>
+
+using nm_input = struct tag_nm_input*;
+nm_input input_open(const char* path);
+size_t input_read(nm_input, const char** data);
+int input_token(nm_input, char* buf, size_t size);
+size_t input_line(nm_input);
+int input_close(nm_input);
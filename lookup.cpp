@@ -0,0 +1,513 @@
+#include "lookup.h"
+#include <algorithm>
+#include <bit>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+#include <Windows.h>
+#include "errors.h"
+#include "input.h"
+#include "netmask_int.h"
+#include "output.h"
+
+constexpr char table_magic[8]{ 'n', 'm', 't', 'a', 'b', 'l', 'e', '2' };
+constexpr unsigned table_extended{ 0x80000000U };
+constexpr size_t table_slots{ 1 << 24 };
+constexpr size_t table_batch{ 256 };
+constexpr int trie_direct_bits{ 16 };
+constexpr size_t trie_direct{ 1 << trie_direct_bits };
+constexpr int trie_stride{ 6 };
+
+struct table_header
+{
+	char magic[8];
+	unsigned prefixes;
+	unsigned groups;
+	unsigned prefixes6;
+	unsigned nodes;
+	unsigned leaves;
+	unsigned reserved;
+};
+
+struct table_prefix
+{
+	unsigned net_address;
+	unsigned length;
+};
+
+struct table_route
+{
+	unsigned net_address;
+	unsigned char length;
+	unsigned value;
+};
+
+struct trie_prefix
+{
+	unsigned long long h;
+	unsigned long long l;
+	unsigned length;
+	unsigned reserved;
+};
+
+struct trie_route
+{
+	uint128 net_address;
+	unsigned char length;
+	unsigned value;
+};
+
+struct trie_node
+{
+	unsigned long long vector;
+	unsigned long long leafvec;
+	unsigned base0;
+	unsigned base1;
+};
+
+using trie_children = std::vector<std::pair<unsigned, std::vector<trie_route>>>;
+
+struct tag_nm_table
+{
+	table_header header;
+	const table_prefix* prefixes;
+	const unsigned* tbl24;
+	const unsigned* tbl8;
+	const trie_prefix* prefixes6;
+	const unsigned* direct;
+	const trie_node* nodes;
+	const unsigned* leaves;
+	std::vector<table_prefix> prefix_storage;
+	std::vector<unsigned> tbl24_storage;
+	std::vector<unsigned> tbl8_storage;
+	std::vector<trie_prefix> prefix6_storage;
+	std::vector<unsigned> direct_storage;
+	std::vector<trie_node> node_storage;
+	std::vector<unsigned> leaf_storage;
+	std::vector<std::string> tags;
+	unsigned cover;
+	HANDLE file;
+	HANDLE mapping;
+	const void* view;
+};
+
+static void table_build(const nm_table self, std::vector<table_route>& routes)
+{
+	std::stable_sort(routes.begin(), routes.end(), [](const table_route& a, const table_route& b) { return a.length < b.length; });
+	std::vector<unsigned>& tbl24{ self->tbl24_storage };
+	std::vector<unsigned>& tbl8{ self->tbl8_storage };
+	tbl24.assign(table_slots, 0);
+	for (const table_route& r : routes)
+	{
+		if (r.length <= 24)
+		{
+			const size_t first{ r.net_address >> 8 };
+			std::fill_n(tbl24.begin() + static_cast<std::ptrdiff_t>(first), static_cast<size_t>(1) << (24 - r.length), r.value);
+			continue;
+		}
+		unsigned& slot{ tbl24[r.net_address >> 8] };
+		if (!(slot & table_extended))
+		{
+			tbl8.insert(tbl8.end(), 256, slot);
+			slot = table_extended | self->header.groups++;
+		}
+		const size_t first{ static_cast<size_t>(slot & ~table_extended) << 8 | (r.net_address & 0xff) };
+		std::fill_n(tbl8.begin() + static_cast<std::ptrdiff_t>(first), static_cast<size_t>(1) << (32 - r.length), r.value);
+	}
+	self->tbl24 = tbl24.data();
+	self->tbl8 = tbl8.data();
+	status("built table of %zu prefixes with %u extended groups", routes.size(), self->header.groups);
+}
+
+static unsigned trie_index(const uint128& key, const int depth)
+{
+	if (depth == 0)
+		return static_cast<unsigned>(key.h >> (64 - trie_direct_bits));
+	if (depth < 64)
+		return key.h >> (64 - trie_stride - depth) & 63;
+	if (depth <= 128 - trie_stride)
+		return key.l >> (128 - trie_stride - depth) & 63;
+	return key.l << (depth + trie_stride - 128) & 63;
+}
+
+static void trie_slots(const std::vector<trie_route>& routes, const int depth, const int stride, const unsigned fallback, std::vector<unsigned>& values, trie_children& children)
+{
+	std::vector<const trie_route*> shorter;
+	values.assign(static_cast<size_t>(1) << stride, fallback);
+	for (const trie_route& r : routes)
+	{
+		if (r.length <= depth + stride)
+		{
+			shorter.push_back(&r);
+			continue;
+		}
+		const unsigned slot{ trie_index(r.net_address, depth) };
+		if (children.empty() || children.back().first != slot)
+			children.emplace_back(slot, std::vector<trie_route>{});
+		children.back().second.push_back(r);
+	}
+	std::stable_sort(shorter.begin(), shorter.end(), [](const trie_route* a, const trie_route* b) { return a->length < b->length; });
+	for (const trie_route* r : shorter)
+		std::fill_n(values.begin() + trie_index(r->net_address, depth), static_cast<size_t>(1) << (depth + stride - r->length), r->value);
+}
+
+static void trie_node_build(const nm_table self, const std::vector<trie_route>& routes, const int depth, const unsigned fallback, const size_t index)
+{
+	std::vector<unsigned> values;
+	trie_children children;
+	trie_node node{ 0, 0, static_cast<unsigned>(self->leaf_storage.size()), static_cast<unsigned>(self->node_storage.size()) };
+	trie_slots(routes, depth, trie_stride, fallback, values, children);
+	for (unsigned slot{}, c{}; slot < values.size(); slot++)
+	{
+		if (c < children.size() && children[c].first == slot)
+		{
+			node.vector |= 1ULL << slot;
+			c++;
+		}
+		else if (static_cast<unsigned>(self->leaf_storage.size()) == node.base0 || self->leaf_storage.back() != values[slot])
+		{
+			node.leafvec |= 1ULL << slot;
+			self->leaf_storage.push_back(values[slot]);
+		}
+	}
+	self->node_storage.resize(self->node_storage.size() + children.size());
+	self->node_storage[index] = node;
+	for (size_t c{}; c < children.size(); c++)
+		trie_node_build(self, children[c].second, depth + trie_stride, values[children[c].first], node.base1 + c);
+}
+
+static void trie_build(const nm_table self, const std::vector<trie_route>& routes)
+{
+	std::vector<unsigned>& direct{ self->direct_storage };
+	trie_children children;
+	trie_slots(routes, 0, trie_direct_bits, 0, direct, children);
+	self->node_storage.resize(children.size());
+	for (size_t c{}; c < children.size(); c++)
+	{
+		const unsigned slot{ children[c].first };
+		trie_node_build(self, children[c].second, trie_direct_bits, direct[slot], c);
+		direct[slot] = table_extended | static_cast<unsigned>(c);
+	}
+	self->header.nodes = static_cast<unsigned>(self->node_storage.size());
+	self->header.leaves = static_cast<unsigned>(self->leaf_storage.size());
+	self->direct = direct.data();
+	self->nodes = self->node_storage.data();
+	self->leaves = self->leaf_storage.data();
+	status("built trie of %zu prefixes with %u nodes and %u leaves in %zu bytes", routes.size(), self->header.nodes, self->header.leaves,
+		trie_direct * sizeof(unsigned) + self->node_storage.size() * sizeof(trie_node) + self->leaf_storage.size() * sizeof(unsigned));
+}
+
+static unsigned trie_lookup(const tag_nm_table* self, const uint128& key)
+{
+	unsigned entry{ self->direct[trie_index(key, 0)] };
+	for (int depth{ trie_direct_bits }; entry & table_extended; depth += trie_stride)
+	{
+		const trie_node& node{ self->nodes[entry & ~table_extended] };
+		const unsigned slot{ trie_index(key, depth) };
+		const unsigned long long below{ (2ULL << slot) - 1 };
+		if (!(node.vector >> slot & 1))
+			return self->leaves[node.base0 + std::popcount(node.leafvec & below) - 1];
+		entry = table_extended | (node.base1 + std::popcount(node.vector & below) - 1);
+	}
+	return entry;
+}
+
+nm_table nm_table_new(const nm list)
+{
+	const nm_table self{ new tag_nm_table{} };
+	std::vector<table_route> routes;
+	std::vector<trie_route> routes6;
+	memcpy(self->header.magic, table_magic, sizeof table_magic);
+	nm_normalize(list);
+	for (size_t i{}; list && i < list->keys.size(); i++)
+	{
+		if (!is_v4(list->keys[i], list->lengths[i], AF_INET))
+		{
+			self->prefix6_storage.push_back(trie_prefix{ list->keys[i].h, list->keys[i].l, list->lengths[i], 0 });
+			routes6.push_back(trie_route{ list->keys[i], list->lengths[i], static_cast<unsigned>(self->prefix6_storage.size()) });
+			continue;
+		}
+		const table_prefix p{ static_cast<unsigned>(list->keys[i].l), list->lengths[i] - 96U };
+		self->prefix_storage.push_back(p);
+		routes.push_back(table_route{ p.net_address, static_cast<unsigned char>(p.length), static_cast<unsigned>(self->prefix_storage.size()) });
+	}
+	self->header.prefixes = static_cast<unsigned>(self->prefix_storage.size());
+	self->header.prefixes6 = static_cast<unsigned>(self->prefix6_storage.size());
+	self->prefixes = self->prefix_storage.data();
+	self->prefixes6 = self->prefix6_storage.data();
+	table_build(self, routes);
+	trie_build(self, routes6);
+	self->cover = trie_lookup(self, uint128_lit(0, 0x0000ffff00000000ULL));
+	nm_free(list);
+	return self;
+}
+
+struct class_route
+{
+	uint128 net_address;
+	unsigned char length;
+	unsigned list;
+	unsigned value;
+};
+
+static int covers(const class_route& outer, const class_route& inner)
+{
+	return outer.length <= inner.length && uint128_cmp(uint128_and(inner.net_address, uint128_cidr(outer.length)), outer.net_address) == 0;
+}
+
+nm_table nm_table_classify(const char* const* names, const nm* lists, const size_t count)
+{
+	const nm_table self{ new tag_nm_table{} };
+	std::vector<class_route> all, stack;
+	std::vector<table_route> routes;
+	std::vector<trie_route> routes6;
+	std::vector<std::vector<unsigned>> sets;
+	std::map<std::vector<unsigned>, unsigned> ids;
+	memcpy(self->header.magic, table_magic, sizeof table_magic);
+	for (unsigned list{}; list < count; list++)
+	{
+		nm_normalize(lists[list]);
+		for (size_t i{}; lists[list] && i < lists[list]->keys.size(); i++)
+			all.push_back(class_route{ lists[list]->keys[i], lists[list]->lengths[i], list, 0 });
+		nm_free(lists[list]);
+	}
+	std::sort(all.begin(), all.end(), [](const class_route& a, const class_route& b)
+	{
+		const int cmp{ uint128_cmp(a.net_address, b.net_address) };
+		return cmp < 0 || (cmp == 0 && (a.length < b.length || (a.length == b.length && a.list < b.list)));
+	});
+	for (class_route& r : all)
+	{
+		while (!stack.empty() && !covers(stack.back(), r))
+			stack.pop_back();
+		std::vector<unsigned> set{ stack.empty() ? std::vector<unsigned>{} : sets[stack.back().value - 1] };
+		if (!std::binary_search(set.begin(), set.end(), r.list))
+			set.insert(std::upper_bound(set.begin(), set.end(), r.list), r.list);
+		const auto [it, added] { ids.emplace(set, static_cast<unsigned>(sets.size() + 1)) };
+		if (added)
+		{
+			std::string tag;
+			for (const unsigned list : set)
+				tag.append(tag.empty() ? "" : ",").append(names[list]);
+			sets.push_back(set);
+			self->tags.push_back(tag);
+		}
+		r.value = it->second;
+		stack.push_back(r);
+		if (is_v4(r.net_address, r.length, AF_INET))
+			routes.push_back(table_route{ static_cast<unsigned>(r.net_address.l), static_cast<unsigned char>(r.length - 96), r.value });
+		else
+			routes6.push_back(trie_route{ r.net_address, r.length, r.value });
+	}
+	status("classifying %zu prefixes from %zu lists into %zu tag sets", all.size(), count, sets.size());
+	table_build(self, routes);
+	trie_build(self, routes6);
+	self->cover = trie_lookup(self, uint128_lit(0, 0x0000ffff00000000ULL));
+	return self;
+}
+
+nm_table nm_table_load(const char* path)
+{
+	const nm_table self{ new tag_nm_table{} };
+	LARGE_INTEGER size{};
+	self->file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (self->file == INVALID_HANDLE_VALUE || !GetFileSizeEx(self->file, &size) || static_cast<size_t>(size.QuadPart) < sizeof(table_header))
+	{
+		warn("failed to open table \"%s\"", path);
+		nm_table_free(self);
+		return nullptr;
+	}
+	self->mapping = CreateFileMappingA(self->file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (self->mapping)
+		self->view = MapViewOfFile(self->mapping, FILE_MAP_READ, 0, 0, 0);
+	if (!self->view)
+	{
+		warn("failed to map table \"%s\"", path);
+		nm_table_free(self);
+		return nullptr;
+	}
+	const char* p{ static_cast<const char*>(self->view) };
+	memcpy(&self->header, p, sizeof self->header);
+	const size_t expected{ sizeof(table_header) + self->header.prefixes * sizeof(table_prefix) + (table_slots + static_cast<size_t>(self->header.groups) * 256) * sizeof(unsigned) +
+		self->header.prefixes6 * sizeof(trie_prefix) + (trie_direct + self->header.leaves) * sizeof(unsigned) + self->header.nodes * sizeof(trie_node) };
+	if (memcmp(self->header.magic, table_magic, sizeof table_magic) != 0 || static_cast<size_t>(size.QuadPart) != expected)
+	{
+		warn("\"%s\" is not a netmask table", path);
+		nm_table_free(self);
+		return nullptr;
+	}
+	p += sizeof(table_header);
+	self->prefixes = reinterpret_cast<const table_prefix*>(p);
+	p += self->header.prefixes * sizeof(table_prefix);
+	self->tbl24 = reinterpret_cast<const unsigned*>(p);
+	self->tbl8 = self->tbl24 + table_slots;
+	p = reinterpret_cast<const char*>(self->tbl8 + static_cast<size_t>(self->header.groups) * 256);
+	self->prefixes6 = reinterpret_cast<const trie_prefix*>(p);
+	self->direct = reinterpret_cast<const unsigned*>(self->prefixes6 + self->header.prefixes6);
+	self->nodes = reinterpret_cast<const trie_node*>(self->direct + trie_direct);
+	self->leaves = reinterpret_cast<const unsigned*>(self->nodes + self->header.nodes);
+	self->cover = trie_lookup(self, uint128_lit(0, 0x0000ffff00000000ULL));
+	return self;
+}
+
+int nm_table_save(const nm_table self, const char* path)
+{
+	FILE* fp{};
+	if (fopen_s(&fp, path, "wb") != 0 || !fp)
+	{
+		warn("failed to create \"%s\"", path);
+		return 0;
+	}
+	const size_t groups{ static_cast<size_t>(self->header.groups) * 256 };
+	const bool ok{
+		fwrite(&self->header, sizeof self->header, 1, fp) == 1 &&
+		fwrite(self->prefixes, sizeof(table_prefix), self->header.prefixes, fp) == self->header.prefixes &&
+		fwrite(self->tbl24, sizeof(unsigned), table_slots, fp) == table_slots &&
+		fwrite(self->tbl8, sizeof(unsigned), groups, fp) == groups &&
+		fwrite(self->prefixes6, sizeof(trie_prefix), self->header.prefixes6, fp) == self->header.prefixes6 &&
+		fwrite(self->direct, sizeof(unsigned), trie_direct, fp) == trie_direct &&
+		fwrite(self->nodes, sizeof(trie_node), self->header.nodes, fp) == self->header.nodes &&
+		fwrite(self->leaves, sizeof(unsigned), self->header.leaves, fp) == self->header.leaves };
+	if (fclose(fp) != 0 || !ok)
+	{
+		warn("failed to write \"%s\"", path);
+		return 0;
+	}
+	return 1;
+}
+
+void nm_table_free(const nm_table self)
+{
+	if (!self)
+		return;
+	if (self->view)
+		UnmapViewOfFile(self->view);
+	if (self->mapping)
+		CloseHandle(self->mapping);
+	if (self->file && self->file != INVALID_HANDLE_VALUE)
+		CloseHandle(self->file);
+	delete self;
+}
+
+void nm_table_lookup(const nm_table self, const unsigned* addresses, const size_t count, unsigned* values)
+{
+	const unsigned* tbl24{ self->tbl24 };
+	const unsigned* tbl8{ self->tbl8 };
+	for (size_t i{}; i < count; i++)
+		values[i] = tbl24[addresses[i] >> 8];
+	for (size_t i{}; i < count; i++)
+		if (values[i] & table_extended)
+			values[i] = tbl8[static_cast<size_t>(values[i] & ~table_extended) << 8 | (addresses[i] & 0xff)];
+}
+
+void nm_table_lookup6(const nm_table self, const in6_addr* addresses, const size_t count, unsigned* values)
+{
+	for (size_t i{}; i < count; i++)
+		values[i] = trie_lookup(self, uint128_of_s6(&addresses[i]));
+}
+
+struct query_batch
+{
+	std::string words;
+	std::vector<size_t> offsets;
+	int domains[table_batch];
+	unsigned addresses[table_batch];
+	uint128 addresses6[table_batch];
+	size_t count;
+	size_t count6;
+};
+
+static void query_flush(const nm_table self, query_batch& batch, void (*cb)(int, const nm_address*, nm_address*))
+{
+	unsigned values[table_batch], values6[table_batch];
+	nm_table_lookup(self, batch.addresses, batch.count, values);
+	for (size_t i{}; i < batch.count6; i++)
+		values6[i] = trie_lookup(self, batch.addresses6[i]);
+	for (size_t i{}, v4{}, v6{}; i < batch.offsets.size(); i++)
+	{
+		const char* word{ batch.words.data() + batch.offsets[i] };
+		int domain{ batch.domains[i] };
+		unsigned value{ domain == AF_INET ? values[v4++] : domain == AF_INET6 ? values6[v6++] : 0 };
+		nm_address n{}, m{};
+		if (domain == AF_INET && !value && self->cover)
+		{
+			domain = AF_INET6;
+			value = self->cover;
+		}
+		out_write(word, strlen(word));
+		out_write(" ", 1);
+		if (!value)
+			out_write("-\n", 2);
+		else if (!self->tags.empty())
+		{
+			const std::string& tag{ self->tags[value - 1] };
+			out_write(tag.data(), tag.size());
+			out_write("\n", 1);
+		}
+		else if (domain == AF_INET)
+		{
+			const table_prefix& p{ self->prefixes[value - 1] };
+			n.s.s_addr = htonl(p.net_address);
+			m.s.s_addr = htonl(p.length ? ~0U << (32 - p.length) : 0);
+			cb(AF_INET, &n, &m);
+		}
+		else
+		{
+			const trie_prefix& p{ self->prefixes6[value - 1] };
+			n.s6 = s6_of_u128(uint128_lit(p.h, p.l));
+			m.s6 = s6_of_u128(uint128_cidr(static_cast<unsigned char>(p.length)));
+			cb(AF_INET6, &n, &m);
+		}
+	}
+	batch.words.clear();
+	batch.offsets.clear();
+	batch.count = 0;
+	batch.count6 = 0;
+}
+
+int nm_query(const nm_table self, const char* path, void (*cb)(int, const nm_address*, nm_address*))
+{
+	const nm_input in{ input_open(path) };
+	if (!in)
+	{
+		warn("failed to open \"%s\"", path);
+		return 1;
+	}
+	char buf[1024]{};
+	query_batch batch{};
+	batch.offsets.reserve(table_batch);
+	while (input_token(in, buf, sizeof buf))
+	{
+		in_addr s{};
+		in6_addr s6{};
+		int& domain{ batch.domains[batch.offsets.size()] };
+		domain = 0;
+		if (inet_pton(AF_INET, buf, &s) == 1)
+		{
+			domain = AF_INET;
+			batch.addresses[batch.count++] = ntohl(s.s_addr);
+		}
+		else if (inet_pton(AF_INET6, buf, &s6) == 1)
+		{
+			const uint128 key{ uint128_of_s6(&s6) };
+			if (is_v4(key, 128, AF_INET))
+			{
+				domain = AF_INET;
+				batch.addresses[batch.count++] = static_cast<unsigned>(key.l);
+			}
+			else
+			{
+				domain = AF_INET6;
+				batch.addresses6[batch.count6++] = key;
+			}
+		}
+		batch.offsets.push_back(batch.words.size());
+		batch.words.append(buf, strlen(buf) + 1);
+		if (batch.offsets.size() == table_batch)
+			query_flush(self, batch, cb);
+	}
+	query_flush(self, batch, cb);
+	return input_close(in) ? 1 : 0;
+}
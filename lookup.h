@@ -0,0 +1,13 @@
+#pragma once
+#include <cstddef>
+#include "netmask.h"
+
+using nm_table = struct tag_nm_table*;
+nm_table nm_table_new(nm);
+nm_table nm_table_classify(const char* const* names, const nm*, size_t);
+nm_table nm_table_load(const char* path);
+int nm_table_save(nm_table, const char* path);
+void nm_table_free(nm_table);
+void nm_table_lookup(nm_table, const unsigned*, size_t, unsigned*);
+void nm_table_lookup6(nm_table, const in6_addr*, size_t, unsigned*);
+int nm_query(nm_table, const char* path, void (*)(int, const nm_address*, nm_address*));
@@ -1,12 +1,38 @@
 #define VERSION "2.4.5"
 
+#include <algorithm>
+#include <bit>
+#include <cctype>
 #include <cerrno>
 #include <cmath>
+#include <cstring>
 #include <iostream>
+#include <random>
+#include <thread>
+#include <vector>
 #include <Windows.h>
+#include "bench.h"
+#include "csv.h"
+#include "daemon.h"
+#include "enumerate.h"
 #include "errors.h"
+#include "expand.h"
 #include "getopt.h"
+#include "mmdb.h"
+#include "input.h"
+#include "lookup.h"
+#include "merge.h"
 #include "netmask.h"
+#include "output.h"
+#include "overlap.h"
+#include "sample.h"
+#include "watch.h"
+#include "wildcard.h"
+
+#if defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__)
+#define NM_SSE2 1
+#include <emmintrin.h>
+#endif
 
 struct address_mask
 {
@@ -16,6 +42,40 @@ struct address_mask
 	address_mask* prev;
 };
 
+enum long_only
+{
+	opt_daemon = 256,
+	opt_diff,
+	opt_max_prefixes,
+	opt_ipset,
+	opt_nft,
+	opt_iptables,
+	opt_ip6tables,
+	opt_noflush,
+	opt_name,
+	opt_table,
+	opt_table_out,
+	opt_lookup,
+	opt_list,
+	opt_summary,
+	opt_overlaps,
+	opt_watch,
+	opt_output,
+	opt_stats,
+	opt_benchmark,
+	opt_csv,
+	opt_filter,
+	opt_mmdb,
+	opt_enumerate,
+	opt_limit,
+	opt_offset,
+	opt_sample,
+	opt_seed,
+	opt_unique,
+	opt_merge_sorted,
+	opt_wildcard
+};
+
 option long_options[] =
 {
 	{ "version", 0, nullptr, 'v' },
@@ -30,6 +90,36 @@ option long_options[] =
 	{ "binary", 0, nullptr, 'b' },
 	{ "nodns", 0, nullptr, 'n' },
 	{ "files", 0, nullptr, 'f' },
+	{ "daemon", 1, nullptr, opt_daemon },
+	{ "diff", 0, nullptr, opt_diff },
+	{ "max-prefixes", 1, nullptr, opt_max_prefixes },
+	{ "ipset", 0, nullptr, opt_ipset },
+	{ "nft", 0, nullptr, opt_nft },
+	{ "iptables", 0, nullptr, opt_iptables },
+	{ "ip6tables", 0, nullptr, opt_ip6tables },
+	{ "noflush", 0, nullptr, opt_noflush },
+	{ "name", 1, nullptr, opt_name },
+	{ "table", 1, nullptr, opt_table },
+	{ "table-out", 1, nullptr, opt_table_out },
+	{ "lookup", 1, nullptr, opt_lookup },
+	{ "list", 1, nullptr, opt_list },
+	{ "summary", 2, nullptr, opt_summary },
+	{ "overlaps", 0, nullptr, opt_overlaps },
+	{ "watch", 0, nullptr, opt_watch },
+	{ "output", 1, nullptr, opt_output },
+	{ "stats", 0, nullptr, opt_stats },
+	{ "benchmark", 1, nullptr, opt_benchmark },
+	{ "csv", 1, nullptr, opt_csv },
+	{ "filter", 1, nullptr, opt_filter },
+	{ "mmdb", 0, nullptr, opt_mmdb },
+	{ "enumerate", 0, nullptr, opt_enumerate },
+	{ "limit", 1, nullptr, opt_limit },
+	{ "offset", 1, nullptr, opt_offset },
+	{ "sample", 1, nullptr, opt_sample },
+	{ "seed", 1, nullptr, opt_seed },
+	{ "unique", 0, nullptr, opt_unique },
+	{ "merge-sorted", 0, nullptr, opt_merge_sorted },
+	{ "wildcard", 0, nullptr, opt_wildcard },
 	{ nullptr, 0, nullptr, 0 }
 };
 
@@ -41,7 +131,15 @@ enum output
 	out_range,
 	out_hex,
 	out_octal,
-	out_binary
+	out_binary,
+	out_ipset,
+	out_nft,
+	out_iptables,
+	out_ip6tables,
+	out_summary,
+	out_summary_json,
+	out_enumerate,
+	out_wildcard
 };
 
 const char* version{ "netmask, version " VERSION };
@@ -49,19 +147,36 @@ const char* v_version{ __DATE__ " " __TIME__ };
 const char* usage{ "Try '%s --help' for more information." };
 char* program_name{};
 
+struct format_tables
+{
+	char hex[256][2];
+	char binary[256][8];
+
+	constexpr format_tables() : hex{}, binary{}
+	{
+		for (int i{}; i < 256; i++)
+		{
+			hex[i][0] = "0123456789abcdef"[i >> 4];
+			hex[i][1] = "0123456789abcdef"[i & 0xf];
+			for (int j{}; j < 8; j++)
+				binary[i][j] = i & 0x80 >> j ? '1' : '0';
+		}
+	}
+};
+
+static constexpr format_tables tables{};
+
 void display_std(const int domain, const nm_address* n, const nm_address* m)
 {
 	char nb[INET6_ADDRSTRLEN + 1]{}, mb[INET6_ADDRSTRLEN + 1]{};
 	inet_ntop(domain, n, nb, INET6_ADDRSTRLEN);
 	inet_ntop(domain, m, mb, INET6_ADDRSTRLEN);
-	[[maybe_unused]] int result{ printf_s("%15s/%-15s\n", nb, mb) };
+	out_printf("%15s/%-15s\n", nb, mb);
 }
 
-static void display_cidr(const int domain, const nm_address* n, const nm_address* m)
+static int mask_length(const int domain, const nm_address* m)
 {
-	char nb[INET6_ADDRSTRLEN + 1]{};
 	int cidr{};
-	inet_ntop(domain, n, nb, INET6_ADDRSTRLEN);
 	if (domain == AF_INET)
 	{
 		for (unsigned mask{ ntohl(m->s.s_addr) }; mask; mask <<= 1)
@@ -73,7 +188,14 @@ static void display_cidr(const int domain, const nm_address* n, const nm_address
 			for (unsigned char c{ m->s6.s6_addr[i]}; c; c <<= 1)
 				cidr++;
 	}
-	[[maybe_unused]] int result{ printf_s("%15s/%d\n", nb, cidr) };
+	return cidr;
+}
+
+static void display_cidr(const int domain, const nm_address* n, const nm_address* m)
+{
+	char nb[INET6_ADDRSTRLEN + 1]{};
+	inet_ntop(domain, n, nb, INET6_ADDRSTRLEN);
+	out_printf("%15s/%d\n", nb, mask_length(domain, m));
 }
 
 static void display_cisco(const int domain, const nm_address* n, nm_address* m)
@@ -86,7 +208,41 @@ static void display_cisco(const int domain, const nm_address* n, nm_address* m)
 		m->s.s_addr = ~m->s.s_addr;
 	inet_ntop(domain, n, nb, INET6_ADDRSTRLEN);
 	inet_ntop(domain, m, mb, INET6_ADDRSTRLEN);
-	[[maybe_unused]] int result{ printf_s("%15s %-15s\n", nb, mb) };
+	out_printf("%15s %-15s\n", nb, mb);
+}
+
+static std::vector<nm_wildcard> wildcards;
+static size_t wildcard_prefixes{};
+static size_t wildcard_rules{};
+
+static void wildcard_flush()
+{
+	char nb[INET_ADDRSTRLEN + 1]{}, mb[INET_ADDRSTRLEN + 1]{};
+	wildcard_prefixes += wildcards.size();
+	wildcards.resize(nm_wildcard_merge(wildcards.data(), wildcards.size()));
+	wildcard_rules += wildcards.size();
+	for (const nm_wildcard& w : wildcards)
+	{
+		const in_addr n{ .s_addr = htonl(w.address) }, m{ .s_addr = htonl(w.mask) };
+		inet_ntop(AF_INET, &n, nb, INET_ADDRSTRLEN);
+		inet_ntop(AF_INET, &m, mb, INET_ADDRSTRLEN);
+		out_printf("%15s %-15s\n", nb, mb);
+	}
+	wildcards.clear();
+}
+
+static void display_wildcard(const int domain, const nm_address* n, nm_address* m)
+{
+	if (domain == AF_INET)
+	{
+		wildcards.push_back(nm_wildcard{ ntohl(n->s.s_addr), ~ntohl(m->s.s_addr) });
+		return;
+	}
+	if (!wildcards.empty())
+		wildcard_flush();
+	display_cisco(domain, n, m);
+	wildcard_prefixes++;
+	wildcard_rules++;
 }
 
 static void range_number(char* destination, const unsigned char* source)
@@ -94,10 +250,10 @@ static void range_number(char* destination, const unsigned char* source)
 	char digits[41]{};
 	for (int i{}; i < 17; i++)
 	{
-		bool overflow{ false };
+		int overflow{};
 		for (int j{ sizeof digits - 1 }; j >= 0; j--)
 		{
-			const char temp{ static_cast<char>(digits[j] * 256 + overflow) };
+			const int temp{ digits[j] * 256 + overflow };
 			digits[j] = static_cast<char>(temp % 10);
 			overflow = temp / 10;
 		}
@@ -106,7 +262,7 @@ static void range_number(char* destination, const unsigned char* source)
 		{
 			if (!overflow)
 				break;
-			const char sum{ static_cast<char>(digits[j] + overflow) };
+			const int sum{ digits[j] + overflow };
 			digits[j] = static_cast<char>(sum % 10);
 			overflow = sum / 10;
 		}
@@ -155,64 +311,307 @@ static void display_range(const int domain, const nm_address* n, nm_address* m)
 	range_number(ns, ra);
 	inet_ntop(domain, n, nb, INET6_ADDRSTRLEN);
 	inet_ntop(domain, m, mb, INET6_ADDRSTRLEN);
-	[[maybe_unused]] int result{ printf_s("%15s-%-15s (%s)\n", nb, mb, ns) };
+	out_printf("%15s-%-15s (%s)\n", nb, mb, ns);
+}
+
+static char* hex_bytes(char* p, const unsigned char* source, const int length)
+{
+	for (int i{}; i < length; i++, p += 2)
+		memcpy(p, tables.hex[source[i]], 2);
+	return p;
 }
 
 static void display_hex(const int domain, const nm_address* n, const nm_address* m)
 {
-	if (domain == AF_INET)
-		[[maybe_unused]] int result{ printf_s("0x%08lx/0x%08lx\n", htonl(n->s.s_addr), htonl(m->s.s_addr)) };
-	else
-		[[maybe_unused]] int result{ printf_s("0x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x/0x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x\n", n->s6.s6_addr[0], n->s6.s6_addr[1], n->s6.s6_addr[2], n->s6.s6_addr[3], n->s6.s6_addr[4], n->s6.s6_addr[5], n->s6.s6_addr[6], n->s6.s6_addr[7], n->s6.s6_addr[8], n->s6.s6_addr[9], n->s6.s6_addr[10], n->s6.s6_addr[11], n->s6.s6_addr[12], n->s6.s6_addr[13], n->s6.s6_addr[14], n->s6.s6_addr[15], m->s6.s6_addr[0], m->s6.s6_addr[1], m->s6.s6_addr[2], m->s6.s6_addr[3], m->s6.s6_addr[4], m->s6.s6_addr[5], m->s6.s6_addr[6], m->s6.s6_addr[7], m->s6.s6_addr[8], m->s6.s6_addr[9], m->s6.s6_addr[10], m->s6.s6_addr[11], m->s6.s6_addr[12], m->s6.s6_addr[13], m->s6.s6_addr[14], m->s6.s6_addr[15]) };
+	const int length{ domain == AF_INET ? 4 : 16 };
+	char* p{ out_reserve(8 + 4 * length) };
+	*p++ = '0';
+	*p++ = 'x';
+	p = hex_bytes(p, n->s6.s6_addr, length);
+	*p++ = '/';
+	*p++ = '0';
+	*p++ = 'x';
+	p = hex_bytes(p, m->s6.s6_addr, length);
+	*p++ = '\n';
+	out_commit(p);
+}
+
+static char* octal_word(char* p, const unsigned long v)
+{
+	char digits[11];
+	int i{ sizeof digits };
+	unsigned long rest{ v };
+	do
+		digits[--i] = static_cast<char>('0' + (rest & 7));
+	while (rest >>= 3);
+	for (int pad{ i - 1 }; pad > 0; pad--)
+		*p++ = ' ';
+	memcpy(p, digits + i, sizeof digits - i);
+	return p + (sizeof digits - i);
+}
+
+static char* octal_bytes(char* p, const unsigned char* source)
+{
+	for (int i{}; i < 16; i++, p += 2)
+	{
+		*p++ = '0';
+		memcpy(p, tables.hex[source[i]], 2);
+	}
+	return p;
 }
 
 static void display_octal(const int domain, const nm_address* n, const nm_address* m)
 {
-	if (domain == AF_INET)
-		[[maybe_unused]] int result{ printf_s("0x%10lo/0x%10lo\n", htonl(n->s.s_addr), htonl(m->s.s_addr)) };
-	else
-		[[maybe_unused]] int result{ printf_s("0x%03x%03x%03x%03x%03x%03x%03x%03x%03x%03x%03x%03x%03x%03x%03x%03x/0x%03x%03x%03x%03x%03x%03x%03x%03x%03x%03x%03x%03x%03x%03x%03x%03x\n", n->s6.s6_addr[0], n->s6.s6_addr[1], n->s6.s6_addr[2], n->s6.s6_addr[3], n->s6.s6_addr[4], n->s6.s6_addr[5], n->s6.s6_addr[6], n->s6.s6_addr[7], n->s6.s6_addr[8], n->s6.s6_addr[9], n->s6.s6_addr[10], n->s6.s6_addr[11], n->s6.s6_addr[12], n->s6.s6_addr[13], n->s6.s6_addr[14], n->s6.s6_addr[15], m->s6.s6_addr[0], m->s6.s6_addr[1], m->s6.s6_addr[2], m->s6.s6_addr[3], m->s6.s6_addr[4], m->s6.s6_addr[5], m->s6.s6_addr[6], m->s6.s6_addr[7], m->s6.s6_addr[8], m->s6.s6_addr[9], m->s6.s6_addr[10], m->s6.s6_addr[11], m->s6.s6_addr[12], m->s6.s6_addr[13], m->s6.s6_addr[14], m->s6.s6_addr[15]) };
+	char* p{ out_reserve(104) };
+	*p++ = '0';
+	*p++ = 'x';
+	p = domain == AF_INET ? octal_word(p, htonl(n->s.s_addr)) : octal_bytes(p, n->s6.s6_addr);
+	*p++ = '/';
+	*p++ = '0';
+	*p++ = 'x';
+	p = domain == AF_INET ? octal_word(p, htonl(m->s.s_addr)) : octal_bytes(p, m->s6.s6_addr);
+	*p++ = '\n';
+	out_commit(p);
 }
 
-static void binary_string(char* destination, const unsigned char* source, const int length)
+static char* binary_bytes(char* p, const unsigned char* source, const int length)
 {
-	for (int i{}; i < length; i++)
+#ifdef NM_SSE2
+	const __m128i select{ _mm_setr_epi8(-128, 64, 32, 16, 8, 4, 2, 1, -128, 64, 32, 16, 8, 4, 2, 1) };
+	const __m128i zero{ _mm_set1_epi8('0') };
+	for (int i{}; i < length; i += 2, p += 18)
+	{
+		__m128i v{ _mm_cvtsi32_si128(source[i] | source[i + 1] << 8) };
+		v = _mm_unpacklo_epi8(v, v);
+		v = _mm_unpacklo_epi16(v, v);
+		v = _mm_unpacklo_epi32(v, v);
+		v = _mm_sub_epi8(zero, _mm_cmpeq_epi8(_mm_and_si128(v, select), select));
+		_mm_storel_epi64(reinterpret_cast<__m128i*>(p), v);
+		_mm_storel_epi64(reinterpret_cast<__m128i*>(p + 9), _mm_unpackhi_epi64(v, v));
+		p[8] = ' ';
+		p[17] = ' ';
+	}
+#else
+	for (int i{}; i < length; i++, p += 9)
 	{
-		for (int j{ 7 }; j >= 0; j--)
-			*destination++ = source[i] & 1 << j ? '1' : '0';
-		*destination++ = ' ';
+		memcpy(p, tables.binary[source[i]], 8);
+		p[8] = ' ';
 	}
-	destination[-1] = '\0';
+#endif
+	return p - 1;
 }
 
 static void display_binary(const int domain, const nm_address* n, const nm_address* m)
 {
-	char ns[144]{}, ms[144]{};
-	unsigned char bits[16]{};
-	if (domain == AF_INET)
+	const int length{ domain == AF_INET ? 4 : 16 };
+	char* p{ out_reserve(18 * length + 4) };
+	p = binary_bytes(p, n->s6.s6_addr, length);
+	*p++ = ' ';
+	*p++ = '/';
+	*p++ = ' ';
+	p = binary_bytes(p, m->s6.s6_addr, length);
+	*p++ = '\n';
+	out_commit(p);
+}
+
+constexpr size_t display_chunk_prefixes{ 1 << 14 };
+constexpr unsigned long long display_chunk_addresses{ 1 << 15 };
+
+struct display_chunk
+{
+	out_buffer out[2];
+	size_t prefixes[2];
+	size_t lengths[2][129];
+	unsigned char addresses[2][17];
+};
+
+static std::vector<display_chunk> display_chunks;
+static thread_local display_chunk* display_current{};
+
+constexpr unsigned bulk_maxelem{ 0xffffffff };
+
+static const char* bulk_name{ "netmask" };
+static output bulk_style{};
+static out_buffer bulk_buffers[2]{};
+static size_t bulk_counts[2]{};
+
+static char* append(char* p, const char* s)
+{
+	const size_t n{ strlen(s) };
+	memcpy(p, s, n);
+	return p + n;
+}
+
+static void display_bulk(const int domain, const nm_address* n, nm_address* m)
+{
+	const int v6{ domain == AF_INET6 };
+	display_current->prefixes[v6]++;
+	if ((bulk_style == out_iptables && v6) || (bulk_style == out_ip6tables && !v6))
+		return;
+	out_buffer* previous{ out_select(&display_current->out[v6]) };
+	char* p{ out_reserve(2 * INET6_ADDRSTRLEN + 2 * strlen(bulk_name)) };
+	switch (bulk_style)
 	{
-		unsigned long l{ htonl(n->s.s_addr) };
-		bits[0] = 0xff & l >> 24;
-		bits[1] = 0xff & l >> 16;
-		bits[2] = 0xff & l >> 8;
-		bits[3] = 0xff & l >> 0;
-		binary_string(ns, bits, 4);
-		l = htonl(m->s.s_addr);
-		bits[0] = 0xff & l >> 24;
-		bits[1] = 0xff & l >> 16;
-		bits[2] = 0xff & l >> 8;
-		bits[3] = 0xff & l >> 0;
-		binary_string(ms, bits, 4);
+	case out_ipset:
+		p = append(append(p, "add "), bulk_name);
+		p = append(p, v6 ? "6-tmp " : "-tmp ");
+		break;
+	case out_nft:
+		*p++ = '\t';
+		break;
+	default:
+		p = append(append(append(p, "-A "), bulk_name), " -s ");
+		break;
+	}
+	inet_ntop(domain, n, p, INET6_ADDRSTRLEN);
+	p += strlen(p);
+	*p++ = '/';
+	p += sprintf_s(p, 4, "%d", mask_length(domain, m));
+	p = append(p, bulk_style == out_nft ? ",\n" : bulk_style == out_ipset ? "\n" : " -j DROP\n");
+	out_commit(p);
+	out_select(previous);
+}
+
+static void bulk_finish()
+{
+	char table[256]{};
+	const char* set{ bulk_name };
+	if (const char* dot{ strchr(bulk_name, '.') }; bulk_style == out_nft && dot)
+	{
+		strncpy_s(table, bulk_name, dot - bulk_name);
+		set = dot + 1;
 	}
 	else
+		strcpy_s(table, "netmask");
+	if (bulk_style == out_nft)
+		out_printf("add table inet %s\n", table);
+	else if (bulk_style != out_ipset)
+		out_printf("# load with %s-restore --noflush\n*filter\n:%s - [0:0]\n", bulk_style == out_iptables ? "iptables" : "ip6tables", bulk_name);
+	for (int v6{}; v6 < 2; v6++)
 	{
-		binary_string(ns, n->s6.s6_addr, 16);
-		binary_string(ms, m->s6.s6_addr, 16);
+		out_buffer& b{ bulk_buffers[v6] };
+		const char* suffix{ v6 ? "6" : "" };
+		const char* family{ v6 ? "inet6" : "inet" };
+		const size_t buckets{ std::bit_ceil(std::max<size_t>(bulk_counts[v6], 1024)) };
+		if ((bulk_style == out_iptables && v6) || (bulk_style == out_ip6tables && !v6))
+		{
+			if (bulk_counts[v6])
+				std::cerr << program_name << ": left out " << bulk_counts[v6] << " IPv" << (v6 ? 6 : 4) << " prefixes, use --" << (v6 ? "ip6tables" : "iptables") << " for them" << std::endl;
+			bulk_counts[v6] = 0;
+			continue;
+		}
+		switch (bulk_style)
+		{
+		case out_ipset:
+			out_printf("create %s%s hash:net family %s maxelem %u -exist\n", bulk_name, suffix, family, bulk_maxelem);
+			out_printf("create %s%s-tmp hash:net family %s hashsize %zu maxelem %u -exist\n", bulk_name, suffix, family, buckets, bulk_maxelem);
+			out_printf("flush %s%s-tmp\n", bulk_name, suffix);
+			if (b.length)
+				out_write(b.data, b.length);
+			out_printf("swap %s%s-tmp %s%s\n", bulk_name, suffix, bulk_name, suffix);
+			out_printf("destroy %s%s-tmp\n", bulk_name, suffix);
+			break;
+		case out_nft:
+			out_printf("add set inet %s %s%s { type ipv%s_addr; flags interval; }\n", table, set, suffix, v6 ? "6" : "4");
+			out_printf("flush set inet %s %s%s\n", table, set, suffix);
+			if (!b.length)
+				break;
+			out_printf("add element inet %s %s%s {\n", table, set, suffix);
+			b.data[b.length - 2] = '\n';
+			out_write(b.data, b.length - 1);
+			out_write("}\n", 2);
+			break;
+		default:
+			if (b.length)
+				out_write(b.data, b.length);
+			break;
+		}
+		out_release(&b);
+		bulk_counts[v6] = 0;
 	}
-	[[maybe_unused]] int result{ printf_s("%s / %s\n", ns, ms) };
+	if (bulk_style == out_iptables || bulk_style == out_ip6tables)
+		out_write("COMMIT\n", 7);
 }
 
-void display(const nm nm, const output style)
+static size_t summary_inputs{};
+static size_t summary_prefixes[2]{};
+static size_t summary_lengths[2][129]{};
+static unsigned char summary_addresses[2][17]{};
+
+static void display_summary(const int domain, const nm_address*, nm_address* m)
+{
+	const int v6{ domain == AF_INET6 };
+	const int length{ mask_length(domain, m) };
+	const int bit{ (v6 ? 128 : 32) - length };
+	display_current->prefixes[v6]++;
+	display_current->lengths[v6][length]++;
+	int carry{ 1 << bit % 8 };
+	for (int i{ 16 - bit / 8 }; i >= 0 && carry; i--)
+	{
+		carry += display_current->addresses[v6][i];
+		display_current->addresses[v6][i] = static_cast<unsigned char>(carry);
+		carry >>= 8;
+	}
+}
+
+static void summary_add(const display_chunk& chunk)
+{
+	for (int v6{}; v6 < 2; v6++)
+	{
+		summary_prefixes[v6] += chunk.prefixes[v6];
+		for (int length{}; length <= 128; length++)
+			summary_lengths[v6][length] += chunk.lengths[v6][length];
+		int carry{};
+		for (int i{ 16 }; i >= 0; i--)
+		{
+			carry += summary_addresses[v6][i] + chunk.addresses[v6][i];
+			summary_addresses[v6][i] = static_cast<unsigned char>(carry);
+			carry >>= 8;
+		}
+	}
+}
+
+static void summary_finish(const bool json)
+{
+	const size_t total{ summary_prefixes[0] + summary_prefixes[1] };
+	const double reduction{ summary_inputs ? 100.0 * (1.0 - static_cast<double>(total) / static_cast<double>(summary_inputs)) : 0.0 };
+	char addresses[2][42]{};
+	range_number(addresses[0], summary_addresses[0]);
+	range_number(addresses[1], summary_addresses[1]);
+	if (json)
+	{
+		out_printf("{\"inputs\":%zu,\"prefixes\":%zu,\"reduction\":%.2f", summary_inputs, total, reduction);
+		for (int v6{}; v6 < 2; v6++)
+		{
+			const char* separator{ "" };
+			out_printf(",\"%s\":{\"prefixes\":%zu,\"addresses\":\"%s\",\"lengths\":{", v6 ? "ipv6" : "ipv4", summary_prefixes[v6], addresses[v6]);
+			for (int length{}; length <= (v6 ? 128 : 32); length++)
+				if (summary_lengths[v6][length])
+				{
+					out_printf("%s\"%d\":%zu", separator, length, summary_lengths[v6][length]);
+					separator = ",";
+				}
+			out_write("}}", 2);
+		}
+		out_write("}\n", 2);
+		return;
+	}
+	out_printf("inputs\t\t%zu\n", summary_inputs);
+	out_printf("prefixes\t%zu\n", total);
+	out_printf("reduction\t%.2f%%\n", reduction);
+	out_printf("IPv4\t\t%zu prefixes, %s addresses\n", summary_prefixes[0], addresses[0]);
+	out_printf("IPv6\t\t%zu prefixes, %s addresses\n", summary_prefixes[1], addresses[1]);
+	if (!total)
+		return;
+	out_printf("\nlength\t%12s\t%12s\n", "IPv4", "IPv6");
+	for (int length{}; length <= 128; length++)
+		if (summary_lengths[0][length] || summary_lengths[1][length])
+			out_printf("/%d\t%12zu\t%12zu\n", length, summary_lengths[0][length], summary_lengths[1][length]);
+}
+
+static nm_enumeration enumerate_options{ 0, ~0ULL };
+
+static void (*display_function(const output style))(int, const nm_address*, nm_address*)
 {
 	void (*display_p)(int, const nm_address*, nm_address*) {};
 	switch (style)
@@ -238,21 +637,232 @@ void display(const nm nm, const output style)
 	case out_binary:
 		display_p = reinterpret_cast<void (*)(int, const nm_address*, nm_address*)>(&display_binary);
 		break;
+	case out_ipset:
+	case out_nft:
+	case out_iptables:
+	case out_ip6tables:
+		bulk_style = style;
+		display_p = &display_bulk;
+		break;
+	case out_summary:
+	case out_summary_json:
+		display_p = &display_summary;
+		break;
+	case out_enumerate:
+		break;
+	case out_wildcard:
+		display_p = &display_wildcard;
+		break;
+	}
+	return display_p;
+}
+
+static nm display_set{};
+static output display_style{};
+static void (*display_p)(int, const nm_address*, nm_address*) {};
+static nm_enumerator display_enumerator{};
+
+static void display_format(const size_t chunk, const size_t slot)
+{
+	display_current = &display_chunks[slot];
+	out_buffer* previous{ out_select(&display_current->out[0]) };
+	if (display_enumerator)
+	{
+		const unsigned long long first{ chunk * display_chunk_addresses };
+		nm_enumerator_write(display_enumerator, first, std::min(display_chunk_addresses, nm_enumerator_size(display_enumerator) - first));
+	}
+	else
+		nm_walk_range(display_set, chunk * display_chunk_prefixes, (chunk + 1) * display_chunk_prefixes, display_p);
+	out_select(previous);
+	display_current = nullptr;
+}
+
+static void display_finish(const size_t slot)
+{
+	display_chunk& chunk{ display_chunks[slot] };
+	if (display_style == out_summary || display_style == out_summary_json)
+		summary_add(chunk);
+	else if (display_style >= out_ipset && display_style < out_summary)
+		for (int v6{}; v6 < 2; v6++)
+		{
+			out_buffer* previous{ out_select(&bulk_buffers[v6]) };
+			out_write(chunk.out[v6].data, chunk.out[v6].length);
+			out_select(previous);
+			bulk_counts[v6] += chunk.prefixes[v6];
+		}
+	else
+		out_write(chunk.out[0].data, chunk.out[0].length);
+	for (out_buffer& b : chunk.out)
+		b.length = 0;
+	memset(chunk.prefixes, 0, sizeof chunk.prefixes);
+	memset(chunk.lengths, 0, sizeof chunk.lengths);
+	memset(chunk.addresses, 0, sizeof chunk.addresses);
+}
+
+void display(const nm nm, const output style)
+{
+	size_t chunks{};
+	display_set = nm;
+	display_style = style;
+	display_p = display_function(style);
+	if (style == out_enumerate)
+	{
+		display_enumerator = nm_enumerator_new(nm, &enumerate_options);
+		const unsigned long long size{ nm_enumerator_size(display_enumerator) };
+		chunks = static_cast<size_t>(size / display_chunk_addresses + (size % display_chunk_addresses != 0));
 	}
-	nm_walk(nm, display_p);
+	else
+		chunks = (nm_size(nm) + display_chunk_prefixes - 1) / display_chunk_prefixes;
+	const size_t threads{ style == out_wildcard ? 1 : std::clamp<size_t>(std::thread::hardware_concurrency(), 1, std::max<size_t>(chunks, 1)) };
+	display_chunks.assign(2 * threads, display_chunk{});
+	out_parallel(chunks, threads, display_format, display_finish);
+	for (display_chunk& chunk : display_chunks)
+		for (out_buffer& b : chunk.out)
+			out_release(&b);
+	display_chunks.clear();
+	if (display_enumerator)
+	{
+		nm_enumerator_free(display_enumerator);
+		display_enumerator = nullptr;
+	}
+	if (style == out_summary || style == out_summary_json)
+	{
+		summary_finish(style == out_summary_json);
+		memset(summary_prefixes, 0, sizeof summary_prefixes);
+		memset(summary_lengths, 0, sizeof summary_lengths);
+		memset(summary_addresses, 0, sizeof summary_addresses);
+	}
+	else if (style >= out_ipset && style < out_summary)
+		bulk_finish();
+	else if (style == out_wildcard)
+	{
+		wildcard_flush();
+		std::cerr << program_name << ": " << wildcard_rules << " rules instead of " << wildcard_prefixes << ", saved " << wildcard_prefixes - wildcard_rules << std::endl;
+		wildcard_prefixes = 0;
+		wildcard_rules = 0;
+	}
+}
+
+static output watch_style{};
+
+static void display_watch(const nm nm, const size_t inputs)
+{
+	summary_inputs = inputs;
+	display(nm, watch_style);
 }
 
-static void add_entry(nm* pnm, const char* string, const int dns)
+static void (*diff_display_p)(int, const nm_address*, nm_address*) {};
+static char diff_marker{};
+
+static void display_diff(const int domain, const nm_address* n, nm_address* m)
+{
+	out_write(&diff_marker, 1);
+	diff_display_p(domain, n, m);
+}
+
+static nm_overlap overlaps{};
+
+static void add_entry(nm* pnm, const char* string, const int dns, const char* source, const size_t line)
 {
 	if (const nm n{ nm_new_str(string, dns) })
-		*pnm = nm_merge(*pnm, n);
+	{
+		if (overlaps)
+			nm_overlap_add(overlaps, n, source, line, string);
+		else
+			*pnm = nm_merge(*pnm, n);
+		summary_inputs++;
+	}
 	else
 		warn("parse error \"%s\"", string);
 }
 
+static int show_stats{};
+static nm_csv csv{};
+static int mmdb{};
+static std::vector<nm_filter> filters;
+
+static void report_stats(const char* path, const nm_expand_stats& stats)
+{
+	static const char* const stages[]{ "read", "parse", "aggregate" };
+	static const char* const units[]{ "specs", "prefixes", "blocks" };
+	char buf[1024]{};
+	_snprintf_s(buf, sizeof buf, "%s: %.3f s", path, stats.wall);
+	std::cerr << buf << std::endl;
+	for (int i{}; i < expand_stages; i++)
+	{
+		const double capacity{ stats.wall * static_cast<double>(stats.threads[i]) };
+		_snprintf_s(buf, sizeof buf, "  %-10s%2zu thread%s %6.1f%% busy %12zu %s", stages[i], stats.threads[i], stats.threads[i] == 1 ? " " : "s",
+			capacity > 0 ? 100.0 * stats.busy[i] / capacity : 0.0, stats.items[i], units[i]);
+		std::cerr << buf << std::endl;
+	}
+}
+
+static void add_file(nm* pnm, const char* path, const int dns)
+{
+	char buf[1024]{};
+	if (mmdb)
+	{
+		size_t inputs{};
+		*pnm = nm_merge(*pnm, nm_mmdb_read(path, filters.data(), filters.size(), &inputs));
+		summary_inputs += inputs;
+		return;
+	}
+	const nm_input in{ input_open(strncmp(path, "-", 1) != 0 ? path : "-") };
+	if (!in)
+	{
+		char err[1024]{};
+		[[maybe_unused]] errno_t result{ strerror_s(err, errno) };
+		std::cerr << "Failed to open file: " << path << ": " << err << std::endl;
+		return;
+	}
+	if (csv)
+	{
+		size_t inputs{};
+		*pnm = nm_merge(*pnm, nm_csv_read(csv, in, path, &inputs));
+		summary_inputs += inputs;
+	}
+	else if (overlaps)
+		while (input_token(in, buf, sizeof buf))
+			add_entry(pnm, buf, dns, path, input_line(in));
+	else
+	{
+		const nm_expand expand{ nm_expand_new(dns) };
+		nm_expand_stats stats{};
+		size_t inputs{};
+		while (input_token(in, buf, sizeof buf))
+			nm_expand_add(expand, buf);
+		*pnm = nm_merge(*pnm, nm_expand_finish(expand, &inputs, &stats));
+		summary_inputs += inputs;
+		if (show_stats)
+			report_stats(path, stats);
+	}
+	if (input_close(in))
+		panic("giving up on incomplete input \"%s\"", path);
+}
+
+static int parse_count(const char* str, unsigned long long* value)
+{
+	char* end{};
+	errno = 0;
+	*value = strtoull(str, &end, 0);
+	return isdigit(static_cast<unsigned char>(*str)) && *end == '\0' && errno != ERANGE;
+}
+
 int main(const int argc, char* argv[])
 {
-	int opt_count, h{}, v{}, f{}, dns{ nm_use_dns }, lose{};
+	int opt_count, h{}, v{}, f{}, dns{ nm_use_dns }, lose{}, diff{}, overlap{}, watch{}, merge_sorted{}, noflush{};
+	const char* daemon_path{};
+	const char* table_path{};
+	const char* table_out{};
+	const char* lookup_path{};
+	const char* output_path{};
+	const char* benchmark{};
+	const char* csv_columns{};
+	nm_sampling sampling{};
+	int seeded{};
+	std::vector<const char*> list_names;
+	std::vector<char*> list_paths;
+	size_t max_prefixes{};
 	output output{ out_cidr };
 	program_name = argv[0];
 	init_errors(program_name, 0, 0);
@@ -296,6 +906,148 @@ int main(const int argc, char* argv[])
 		case 'b':
 			output = out_binary;
 			break;
+		case opt_daemon:
+			daemon_path = optarg;
+			break;
+		case opt_diff:
+			diff = 1;
+			break;
+		case opt_ipset:
+			output = out_ipset;
+			break;
+		case opt_nft:
+			output = out_nft;
+			break;
+		case opt_iptables:
+			output = out_iptables;
+			break;
+		case opt_ip6tables:
+			output = out_ip6tables;
+			break;
+		case opt_noflush:
+			noflush = 1;
+			break;
+		case opt_name:
+			bulk_name = optarg;
+			break;
+		case opt_table:
+			table_path = optarg;
+			break;
+		case opt_table_out:
+			table_out = optarg;
+			break;
+		case opt_lookup:
+			lookup_path = optarg;
+			break;
+		case opt_watch:
+			watch = 1;
+			break;
+		case opt_output:
+			output_path = optarg;
+			break;
+		case opt_stats:
+			show_stats = 1;
+			break;
+		case opt_benchmark:
+			benchmark = optarg;
+			break;
+		case opt_csv:
+			csv_columns = optarg;
+			f = 1;
+			break;
+		case opt_mmdb:
+			mmdb = 1;
+			f = 1;
+			break;
+		case opt_filter:
+			filters.emplace_back();
+			if (!nm_filter_parse(optarg, &filters.back()))
+			{
+				std::cerr << "--filter takes FIELD==VALUE or FIELD!=VALUE" << std::endl;
+				return 1;
+			}
+			break;
+		case opt_overlaps:
+			overlap = 1;
+			break;
+		case opt_summary:
+			if (!optarg)
+				output = out_summary;
+			else if (strcmp(optarg, "json") == 0)
+				output = out_summary_json;
+			else
+			{
+				std::cerr << "--summary takes no format or json" << std::endl;
+				return 1;
+			}
+			break;
+		case opt_list:
+			if (char* p{ strchr(optarg, '=') })
+			{
+				*p = '\0';
+				list_names.push_back(optarg);
+				list_paths.push_back(p + 1);
+			}
+			else
+				lose = 1;
+			break;
+		case opt_enumerate:
+			output = out_enumerate;
+			break;
+		case opt_wildcard:
+			output = out_wildcard;
+			break;
+		case opt_limit:
+		case opt_offset:
+		{
+			unsigned long long value{};
+			if (!parse_count(optarg, &value) || (opt_count == opt_limit && value == 0))
+			{
+				std::cerr << (opt_count == opt_limit ? "--limit takes a positive number" : "--offset takes a number") << std::endl;
+				return 1;
+			}
+			if (opt_count == opt_limit)
+				enumerate_options.limit = value;
+			else
+				enumerate_options.offset = value;
+			break;
+		}
+		case opt_sample:
+		case opt_seed:
+		{
+			unsigned long long value{};
+			if (!parse_count(optarg, &value) || (opt_count == opt_sample && value == 0))
+			{
+				std::cerr << (opt_count == opt_sample ? "--sample takes a positive number" : "--seed takes a number") << std::endl;
+				return 1;
+			}
+			if (opt_count == opt_sample)
+				sampling.count = value;
+			else
+			{
+				sampling.seed = value;
+				seeded = 1;
+			}
+			break;
+		}
+		case opt_unique:
+			sampling.unique = true;
+			break;
+		case opt_merge_sorted:
+			merge_sorted = 1;
+			f = 1;
+			break;
+		case opt_max_prefixes:
+		{
+			unsigned long long value{};
+			if (!parse_count(optarg, &value) || value == 0)
+			{
+				std::cerr << "--max-prefixes takes a positive number" << std::endl;
+				return 1;
+			}
+			max_prefixes = static_cast<size_t>(value);
+			break;
+		}
 		default:
 			lose = 1;
 			break;
@@ -320,12 +1072,45 @@ int main(const int argc, char* argv[])
 			<< "  -s, --standard\t\tOutput address/netmask pairs" << std::endl
 			<< "  -c, --cidr\t\t\tOutput CIDR format address lists" << std::endl
 			<< "  -i, --cisco\t\t\tOutput Cisco style address lists" << std::endl
+			<< "      --wildcard\t\tOutput Cisco style lists merged into non-contiguous wildcards" << std::endl
 			<< "  -r, --range\t\t\tOutput ip address ranges" << std::endl
 			<< "  -x, --hex\t\t\tOutput address/netmask pairs in hex" << std::endl
 			<< "  -o, --octal\t\t\tOutput address/netmask pairs in octal" << std::endl
 			<< "  -b, --binary\t\t\tOutput address/netmask pairs in binary" << std::endl
+			<< "      --ipset\t\t\tOutput an ipset restore document" << std::endl
+			<< "      --nft\t\t\tOutput an nft -f document of interval sets" << std::endl
+			<< "      --iptables\t\tOutput an iptables-restore chain that DROPs IPv4 sources" << std::endl
+			<< "      --ip6tables\t\tOutput an ip6tables-restore chain that DROPs IPv6 sources" << std::endl
+			<< "      --noflush\t\t\tConfirm the ip(6)tables chain will be loaded with --noflush," << std::endl
+			<< "\t\t\t\twithout which restoring replaces the whole filter table" << std::endl
+			<< "      --name=NAME\t\tSet or chain name for bulk formats (default netmask)" << std::endl
+			<< "      --summary[=json]\t\tOutput address counts and a prefix length histogram" << std::endl
+			<< "      --enumerate\t\tOutput every address of the result in order" << std::endl
+			<< "      --offset=N\t\tWith --enumerate, skip the first N addresses" << std::endl
+			<< "      --limit=N\t\tWith --enumerate, stop after N addresses" << std::endl
+			<< "      --sample=N\t\tOutput N addresses drawn uniformly from the result" << std::endl
+			<< "      --seed=S\t\tWith --sample, seed the generator for a repeatable draw" << std::endl
+			<< "      --unique\t\tWith --sample, draw each address at most once" << std::endl
+			<< "      --overlaps\t\tReport inputs covered by or overlapping other inputs" << std::endl
 			<< "  -n, --nodns\t\t\tDisable DNS lookups for addresses" << std::endl
 			<< "  -f, --files\t\t\tTreat arguments as input files" << std::endl
+			<< "\t\t\t\tgzip files are decoded in-process; zstd files need the" << std::endl
+			<< "\t\t\t\tzstd program on PATH and cannot be read from stdin" << std::endl
+			<< "      --output=PATH\t\tWrite the result to PATH, replacing it atomically" << std::endl
+			<< "      --stats\t\t\tReport per-stage pipeline utilization for each file" << std::endl
+			<< "      --benchmark=NAME\t\tRun a built-in benchmark: trie, sort" << std::endl
+			<< "      --csv=START[,END]\t\tRead files as CSV with addresses in the given columns" << std::endl
+			<< "      --mmdb\t\t\tRead files as MaxMind databases" << std::endl
+			<< "      --filter=FIELD==VALUE\tKeep only rows or records whose FIELD matches (also !=)" << std::endl
+			<< "      --watch\t\t\tRewrite --output whenever an input file changes" << std::endl
+			<< "      --daemon=PATH\t\tServe add/remove/query/dump requests on a UNIX socket" << std::endl
+			<< "      --diff OLD NEW\t\tOutput -deletions and +additions turning OLD into NEW" << std::endl
+			<< "      --merge-sorted\t\tCombine files that each hold a sorted, aggregated result" << std::endl
+			<< "      --max-prefixes=K\t\tWiden the result to at most K prefixes" << std::endl
+			<< "      --table-out=PATH\t\tWrite an IPv4/IPv6 lookup table of the result to PATH" << std::endl
+			<< "      --table=PATH\t\tLoad a lookup table written by --table-out" << std::endl
+			<< "      --lookup=FILE\t\tPrint the matching prefix for each address in FILE" << std::endl
+			<< "      --list=NAME=FILE\t\tWith --lookup, print the NAMEs of all lists containing each address" << std::endl
 			<< "Definitions:" << std::endl
 			<< "  a spec can be any of:" << std::endl
 			<< "    address" << std::endl
@@ -341,36 +1126,191 @@ int main(const int argc, char* argv[])
 			<< "  a mask is the number of bits set to one from the left" << std::endl;
 		return 0;
 	}
-	if (lose || optind == argc)
+	if (benchmark)
+		return nm_benchmark(benchmark);
+	if (lose || (optind == argc && !daemon_path && !table_path && list_names.empty()))
 	{
 		char buf[1024]{};
 		_snprintf_s(buf, sizeof buf, usage, program_name);
 		std::cerr << buf << std::endl;
 	}
+	if ((!filters.empty() && !csv_columns && !mmdb) || ((csv_columns || mmdb) && (overlap || watch)) || (csv_columns && mmdb))
+	{
+		std::cerr << "--filter requires --csv or --mmdb, which cannot be combined or used with --overlaps or --watch" << std::endl;
+		return 1;
+	}
+	if (csv_columns && !(csv = nm_csv_new(csv_columns, filters.data(), filters.size())))
+	{
+		std::cerr << "--csv takes one or two column numbers or names" << std::endl;
+		return 1;
+	}
+	if ((diff || daemon_path || lookup_path) && output >= out_ipset)
+	{
+		std::cerr << "bulk, summary, enumerate and wildcard output formats cannot be used with --diff, --daemon or --lookup" << std::endl;
+		return 1;
+	}
+	if ((output == out_iptables || output == out_ip6tables) && !noflush)
+	{
+		std::cerr << "--iptables and --ip6tables chains must be loaded with ip(6)tables-restore --noflush; pass --noflush to confirm" << std::endl;
+		return 1;
+	}
+	if (noflush && output != out_iptables && output != out_ip6tables)
+	{
+		std::cerr << "--noflush requires --iptables or --ip6tables" << std::endl;
+		return 1;
+	}
+	if ((enumerate_options.offset || ~enumerate_options.limit) && output != out_enumerate)
+	{
+		std::cerr << "--limit and --offset require --enumerate" << std::endl;
+		return 1;
+	}
+	if ((seeded || sampling.unique) && !sampling.count)
+	{
+		std::cerr << "--seed and --unique require --sample" << std::endl;
+		return 1;
+	}
+	if (sampling.count && (diff || daemon_path || watch || table_path || table_out || lookup_path || overlap || output == out_enumerate))
+	{
+		std::cerr << "--sample cannot be used with --diff, --daemon, --watch, --overlaps, --enumerate or lookup tables" << std::endl;
+		return 1;
+	}
+	if (merge_sorted && (diff || daemon_path || watch || overlap || csv_columns || mmdb || !list_names.empty()))
+	{
+		std::cerr << "--merge-sorted cannot be used with --diff, --daemon, --watch, --overlaps, --csv, --mmdb or --list" << std::endl;
+		return 1;
+	}
+	if (!seeded)
+	{
+		std::random_device device{};
+		sampling.seed = static_cast<unsigned long long>(device()) << 32 | device();
+	}
+	if (watch)
+	{
+		if (!output_path || optind == argc)
+		{
+			std::cerr << "--watch requires --output and at least one input file" << std::endl;
+			return 1;
+		}
+		watch_style = output;
+		return nm_watch(argv + optind, static_cast<size_t>(argc - optind), output_path, dns, display_watch);
+	}
+	if (!list_names.empty())
+	{
+		if (!lookup_path || table_path || table_out)
+		{
+			std::cerr << "--list requires --lookup and cannot be used with --table or --table-out" << std::endl;
+			return 1;
+		}
+		std::vector<nm> lists(list_names.size());
+		for (size_t i{}; i < lists.size(); i++)
+			add_file(&lists[i], list_paths[i], dns);
+		const nm_table table{ nm_table_classify(list_names.data(), lists.data(), lists.size()) };
+		const int result{ nm_query(table, lookup_path, nullptr) };
+		nm_table_free(table);
+		out_flush();
+		return result;
+	}
+	if (diff)
+	{
+		if (argc - optind != 2)
+		{
+			std::cerr << "--diff requires exactly two files: OLD NEW" << std::endl;
+			return 1;
+		}
+		nm from{}, to{}, add{}, del{};
+		add_file(&from, argv[optind], dns);
+		add_file(&to, argv[optind + 1], dns);
+		nm_delta(from, to, &add, &del);
+		diff_display_p = display_function(output);
+		diff_marker = '-';
+		nm_walk(del, display_diff);
+		diff_marker = '+';
+		nm_walk(add, display_diff);
+		out_flush();
+		return 0;
+	}
 	nm nm{};
-	for (; optind < argc; optind++)
+	if (overlap)
+		overlaps = nm_overlap_new();
+	if (merge_sorted && !(nm = nm_merge_files(argv + optind, static_cast<size_t>(argc - optind), dns, &summary_inputs)))
+		return 1;
+	for (; optind < argc && !merge_sorted; optind++)
 	{
 		if (f)
+			add_file(&nm, argv[optind], dns);
+		else
+			add_entry(&nm, argv[optind], dns, "argv", optind);
+	}
+	if (csv)
+		nm_csv_free(csv);
+	if (overlaps)
+	{
+		nm_overlap_report(overlaps);
+		nm_overlap_free(overlaps);
+		out_flush();
+		return 0;
+	}
+	if (max_prefixes)
+	{
+		char ns[42]{};
+		unsigned char ra[17]{};
+		in6_addr extra{};
+		nm = nm_approximate(nm, max_prefixes, &extra);
+		memcpy(ra + 1, extra.s6_addr, sizeof extra.s6_addr);
+		range_number(ns, ra);
+		std::cerr << program_name << ": accepted " << ns << " extra addresses" << std::endl;
+	}
+	if (sampling.count)
+	{
+		int result{};
+		if (output_path)
 		{
-			char buf[1024]{};
-			FILE* fp{};
-			if (strncmp(argv[optind], "-", 1) != 0)
-				[[maybe_unused]] errno_t result{ fopen_s(&fp, argv[optind], "r") };
-			else
-				fp = stdin;
-			if (!fp)
-			{
-				char err[1024]{};
-				[[maybe_unused]] errno_t result{ strerror_s(err, errno) };
-				std::cerr << "Failed to open file: " << argv[optind] << ": " << err << std::endl;
-				continue;
-			}
-			while (fscanf_s(fp, "%1023s", buf) != EOF)
-				add_entry(&nm, buf, dns);
+			out_buffer file{};
+			if (!out_open(&file, output_path))
+				return 1;
+			out_buffer* previous{ out_select(&file) };
+			result = nm_sample(nm, &sampling);
+			out_select(previous);
+			return result && out_replace(&file, output_path) ? 0 : 1;
+		}
+		result = nm_sample(nm, &sampling);
+		out_flush();
+		return result ? 0 : 1;
+	}
+	if (table_path || table_out || lookup_path)
+	{
+		int result{};
+		nm_table table;
+		if (table_path)
+		{
+			nm_free(nm);
+			table = nm_table_load(table_path);
 		}
 		else
-			add_entry(&nm, argv[optind], dns);
+			table = nm_table_new(nm);
+		if (!table)
+			return 1;
+		if (table_out && !nm_table_save(table, table_out))
+			result = 1;
+		if (lookup_path)
+			result |= nm_query(table, lookup_path, display_function(output));
+		nm_table_free(table);
+		out_flush();
+		return result;
+	}
+	if (daemon_path)
+		return nm_daemon(daemon_path, nm, dns, display_function(output));
+	if (output_path)
+	{
+		out_buffer file{};
+		if (!out_open(&file, output_path))
+			return 1;
+		out_buffer* previous{ out_select(&file) };
+		display(nm, output);
+		out_select(previous);
+		return out_replace(&file, output_path) ? 0 : 1;
 	}
 	display(nm, output);
+	out_flush();
 	return 0;
 }
@@ -0,0 +1,137 @@
+#include "merge.h"
+#include <algorithm>
+#include <cstring>
+#include <utility>
+#include <vector>
+#include "errors.h"
+#include "input.h"
+#include "netmask_int.h"
+
+struct merge_source
+{
+	nm list;
+	size_t cur;
+	nm_input in;
+	const char* path;
+	uint128 last_key;
+	unsigned char last_length;
+	bool started;
+};
+
+struct merge_later
+{
+	const std::vector<merge_source>* sources;
+
+	bool operator()(const size_t a, const size_t b) const
+	{
+		const merge_source& x{ (*sources)[a] };
+		const merge_source& y{ (*sources)[b] };
+		const int cmp{ uint128_cmp(x.list->keys[x.cur], y.list->keys[y.cur]) };
+		return cmp > 0 || (cmp == 0 && x.list->lengths[x.cur] > y.list->lengths[y.cur]);
+	}
+};
+
+static int merge_fill(merge_source* self, const int flags, size_t* inputs)
+{
+	char buf[1024]{};
+	while (self->cur >= self->list->keys.size())
+	{
+		if (!self->in || !input_token(self->in, buf, sizeof buf))
+			return 0;
+		self->list->keys.clear();
+		self->list->lengths.clear();
+		self->list->families.clear();
+		self->cur = 0;
+		nm_spec spec{};
+		if (const int rv{ nm_parse(buf, &spec) }; rv == nm_parse_ok)
+			nm_spec_push(self->list, spec);
+		else if (const nm n{ rv == nm_parse_name ? nm_new_str(buf, flags) : nullptr })
+		{
+			nm_normalize(n);
+			nm_free(self->list);
+			self->list = n;
+		}
+		else
+		{
+			warn("parse error \"%s\"", buf);
+			continue;
+		}
+		++*inputs;
+	}
+	const uint128& key{ self->list->keys[self->cur] };
+	const unsigned char length{ self->list->lengths[self->cur] };
+	if (self->in && self->started)
+		if (const int cmp{ uint128_cmp(key, self->last_key) }; cmp < 0 || (cmp == 0 && length < self->last_length))
+		{
+			warn("%s:%zu: input is not sorted", self->path, input_line(self->in));
+			return -1;
+		}
+	self->last_key = key;
+	self->last_length = length;
+	self->started = true;
+	return 1;
+}
+
+static nm merge_sources(std::vector<merge_source>& sources, const int flags, size_t* inputs)
+{
+	std::vector<size_t> heap;
+	heap.reserve(sources.size());
+	const merge_later later{ &sources };
+	int rv{};
+	for (size_t i{}; i < sources.size() && rv >= 0; i++)
+		if ((rv = merge_fill(&sources[i], flags, inputs)) > 0)
+			heap.push_back(i);
+	std::make_heap(heap.begin(), heap.end(), later);
+	nm self{ new tag_nm{} };
+	while (rv >= 0 && !heap.empty())
+	{
+		std::pop_heap(heap.begin(), heap.end(), later);
+		merge_source& source{ sources[heap.back()] };
+		nm_append(self, source.list->keys[source.cur], source.list->lengths[source.cur], source.list->families[source.cur]);
+		source.cur++;
+		if ((rv = merge_fill(&source, flags, inputs)) > 0)
+			std::push_heap(heap.begin(), heap.end(), later);
+		else
+			heap.pop_back();
+	}
+	for (merge_source& source : sources)
+	{
+		nm_free(source.list);
+		if (source.in && input_close(source.in))
+			rv = -1;
+	}
+	if (rv < 0)
+	{
+		nm_free(self);
+		return nullptr;
+	}
+	self->normalized = true;
+	return self;
+}
+
+nm nm_merge_sorted(nm* lists, const size_t count)
+{
+	std::vector<merge_source> sources;
+	sources.reserve(count);
+	size_t inputs{};
+	for (size_t i{}; i < count; i++)
+		if (const nm list{ std::exchange(lists[i], nullptr) })
+		{
+			nm_normalize(list);
+			sources.push_back(merge_source{ list });
+		}
+	return merge_sources(sources, 0, &inputs);
+}
+
+nm nm_merge_files(char* const* paths, const size_t count, const int flags, size_t* inputs)
+{
+	std::vector<merge_source> sources(count);
+	for (size_t i{}; i < count; i++)
+	{
+		sources[i].list = new tag_nm{};
+		sources[i].path = paths[i];
+		if (!(sources[i].in = input_open(strncmp(paths[i], "-", 1) != 0 ? paths[i] : "-")))
+			warn("failed to open file: %s", paths[i]);
+	}
+	return merge_sources(sources, flags, inputs);
+}
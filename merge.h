@@ -0,0 +1,5 @@
+#pragma once
+#include <cstddef>
+#include "netmask.h"
+
+nm nm_merge_files(char* const* paths, size_t count, int flags, size_t* inputs);
@@ -0,0 +1,431 @@
+#include "mmdb.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <Windows.h>
+#include "errors.h"
+#include "netmask_int.h"
+
+constexpr unsigned char mmdb_marker[]{ 0xab, 0xcd, 0xef, 'M', 'a', 'x', 'M', 'i', 'n', 'd', '.', 'c', 'o', 'm' };
+constexpr size_t mmdb_metadata_window{ 128 * 1024 };
+constexpr size_t mmdb_separator{ 16 };
+
+enum
+{
+	mmdb_pointer = 1,
+	mmdb_string = 2,
+	mmdb_double = 3,
+	mmdb_bytes = 4,
+	mmdb_uint16 = 5,
+	mmdb_uint32 = 6,
+	mmdb_map = 7,
+	mmdb_int32 = 8,
+	mmdb_uint64 = 9,
+	mmdb_uint128 = 10,
+	mmdb_array = 11,
+	mmdb_boolean = 14,
+	mmdb_float = 15
+};
+
+struct mmdb_section
+{
+	const unsigned char* base;
+	size_t size;
+};
+
+struct mmdb_value
+{
+	int type;
+	size_t size;
+	size_t offset;
+};
+
+struct mmdb_condition
+{
+	const nm_filter* filter;
+	std::vector<std::string> path;
+};
+
+struct mmdb_file
+{
+	HANDLE file;
+	HANDLE mapping;
+	const unsigned char* view;
+	size_t size;
+	const unsigned char* tree;
+	mmdb_section data;
+	unsigned node_count;
+	unsigned record_size;
+	unsigned ip_version;
+	std::vector<mmdb_condition> conditions;
+	std::unordered_map<size_t, bool> matches;
+};
+
+static bool mmdb_control(const mmdb_section& s, size_t* pos, mmdb_value* v)
+{
+	const auto byte{ [&](const size_t n) { return static_cast<size_t>(s.base[*pos + n]); } };
+	if (*pos >= s.size)
+		return false;
+	const unsigned char control{ s.base[(*pos)++] };
+	v->type = control >> 5;
+	if (v->type == mmdb_pointer)
+	{
+		const size_t length{ static_cast<size_t>(control >> 3 & 3) + 1 };
+		const size_t high{ control & 7u };
+		if (*pos + length > s.size)
+			return false;
+		switch (length)
+		{
+		case 1:
+			v->offset = high << 8 | byte(0);
+			break;
+		case 2:
+			v->offset = (high << 16 | byte(0) << 8 | byte(1)) + 2048;
+			break;
+		case 3:
+			v->offset = (high << 24 | byte(0) << 16 | byte(1) << 8 | byte(2)) + 526336;
+			break;
+		default:
+			v->offset = byte(0) << 24 | byte(1) << 16 | byte(2) << 8 | byte(3);
+			break;
+		}
+		*pos += length;
+		v->size = 0;
+		return true;
+	}
+	if (!v->type)
+	{
+		if (*pos >= s.size)
+			return false;
+		v->type = 7 + s.base[(*pos)++];
+	}
+	v->size = control & 0x1f;
+	if (v->size >= 29)
+	{
+		const size_t length{ v->size - 28 };
+		if (*pos + length > s.size)
+			return false;
+		if (length == 1)
+			v->size = 29 + byte(0);
+		else if (length == 2)
+			v->size = 285 + (byte(0) << 8 | byte(1));
+		else
+			v->size = 65821 + (byte(0) << 16 | byte(1) << 8 | byte(2));
+		*pos += length;
+	}
+	v->offset = *pos;
+	return true;
+}
+
+static bool mmdb_decode(const mmdb_section& s, size_t* pos, mmdb_value* v)
+{
+	if (!mmdb_control(s, pos, v))
+		return false;
+	if (v->type != mmdb_pointer)
+		return true;
+	size_t target{ v->offset };
+	return mmdb_control(s, &target, v) && v->type != mmdb_pointer;
+}
+
+static bool mmdb_skip(const mmdb_section& s, size_t* pos)
+{
+	mmdb_value v{};
+	if (!mmdb_control(s, pos, &v))
+		return false;
+	switch (v.type)
+	{
+	case mmdb_pointer:
+		return true;
+	case mmdb_map:
+		v.size *= 2;
+		[[fallthrough]];
+	case mmdb_array:
+		for (size_t i{}; i < v.size; i++)
+			if (!mmdb_skip(s, pos))
+				return false;
+		return true;
+	case mmdb_boolean:
+		return true;
+	default:
+		*pos += v.size;
+		return *pos <= s.size;
+	}
+}
+
+static unsigned long long mmdb_unsigned(const mmdb_section& s, const mmdb_value& v)
+{
+	unsigned long long n{};
+	if (v.offset + v.size > s.size)
+		return 0;
+	for (size_t i{}; i < v.size && i < 8; i++)
+		n = n << 8 | s.base[v.offset + v.size - std::min<size_t>(v.size, 8) + i];
+	return n;
+}
+
+static bool mmdb_find(const mmdb_section& s, size_t* pos, const std::string& key, mmdb_value* v)
+{
+	mmdb_value map{};
+	if (!mmdb_decode(s, pos, &map))
+		return false;
+	size_t cursor{ map.offset };
+	if (map.type == mmdb_array)
+	{
+		char* end{};
+		const unsigned long index{ strtoul(key.c_str(), &end, 10) };
+		if (key.empty() || *end != '\0' || index >= map.size)
+			return false;
+		for (size_t i{}; i < index; i++)
+			if (!mmdb_skip(s, &cursor))
+				return false;
+		*pos = cursor;
+		return mmdb_decode(s, &cursor, v);
+	}
+	if (map.type != mmdb_map)
+		return false;
+	for (size_t i{}; i < map.size; i++)
+	{
+		mmdb_value name{};
+		const bool pointer{ s.base[cursor] >> 5 == mmdb_pointer };
+		if (!mmdb_decode(s, &cursor, &name) || name.type != mmdb_string || name.offset + name.size > s.size)
+			return false;
+		if (!pointer)
+			cursor = name.offset + name.size;
+		if (name.size == key.size() && memcmp(s.base + name.offset, key.data(), name.size) == 0)
+		{
+			*pos = cursor;
+			return mmdb_decode(s, &cursor, v);
+		}
+		if (!mmdb_skip(s, &cursor))
+			return false;
+	}
+	return false;
+}
+
+static bool mmdb_text(const mmdb_section& s, const mmdb_value& v, std::string* text)
+{
+	char buf[64]{};
+	switch (v.type)
+	{
+	case mmdb_string:
+	case mmdb_bytes:
+		if (v.offset + v.size > s.size)
+			return false;
+		text->assign(reinterpret_cast<const char*>(s.base + v.offset), v.size);
+		return true;
+	case mmdb_uint16:
+	case mmdb_uint32:
+	case mmdb_uint64:
+	case mmdb_uint128:
+		_snprintf_s(buf, sizeof buf, "%llu", mmdb_unsigned(s, v));
+		break;
+	case mmdb_int32:
+		_snprintf_s(buf, sizeof buf, "%d", static_cast<int>(static_cast<unsigned>(mmdb_unsigned(s, v))));
+		break;
+	case mmdb_boolean:
+		strcpy_s(buf, v.size ? "true" : "false");
+		break;
+	case mmdb_double:
+	case mmdb_float:
+	{
+		const unsigned long long bits{ mmdb_unsigned(s, v) };
+		double d{};
+		if (v.type == mmdb_double)
+			memcpy(&d, &bits, sizeof d);
+		else
+		{
+			const unsigned narrow{ static_cast<unsigned>(bits) };
+			float f{};
+			memcpy(&f, &narrow, sizeof f);
+			d = f;
+		}
+		_snprintf_s(buf, sizeof buf, "%g", d);
+		break;
+	}
+	default:
+		return false;
+	}
+	text->assign(buf);
+	return true;
+}
+
+static bool mmdb_match(mmdb_file& db, const size_t offset)
+{
+	const auto [it, added]{ db.matches.emplace(offset, true) };
+	if (!added)
+		return it->second;
+	std::string text;
+	for (const mmdb_condition& c : db.conditions)
+	{
+		size_t pos{ offset };
+		mmdb_value v{};
+		bool found{ true };
+		for (const std::string& key : c.path)
+			if (!mmdb_find(db.data, &pos, key, &v))
+			{
+				found = false;
+				break;
+			}
+		if (!found || !mmdb_text(db.data, v, &text))
+			text.clear();
+		if (!nm_filter_match(*c.filter, text.data(), text.size()))
+		{
+			it->second = false;
+			break;
+		}
+	}
+	return it->second;
+}
+
+static unsigned mmdb_record(const mmdb_file& db, const unsigned node, const int bit)
+{
+	switch (db.record_size)
+	{
+	case 24:
+	{
+		const unsigned char* p{ db.tree + static_cast<size_t>(node) * 6 + bit * 3 };
+		return static_cast<unsigned>(p[0]) << 16 | p[1] << 8 | p[2];
+	}
+	case 28:
+	{
+		const unsigned char* p{ db.tree + static_cast<size_t>(node) * 7 };
+		if (bit)
+			return (p[3] & 0x0fu) << 24 | static_cast<unsigned>(p[4]) << 16 | p[5] << 8 | p[6];
+		return (p[3] & 0xf0u) << 20 | static_cast<unsigned>(p[0]) << 16 | p[1] << 8 | p[2];
+	}
+	default:
+	{
+		const unsigned char* p{ db.tree + static_cast<size_t>(node) * 8 + bit * 4 };
+		return static_cast<unsigned>(p[0]) << 24 | static_cast<unsigned>(p[1]) << 16 | p[2] << 8 | p[3];
+	}
+	}
+}
+
+static bool mmdb_metadata(mmdb_file& db)
+{
+	const size_t window{ std::min(db.size, mmdb_metadata_window) };
+	const unsigned char* start{};
+	for (const unsigned char* p{ db.view + db.size - window }; p + sizeof mmdb_marker <= db.view + db.size; p++)
+		if (memcmp(p, mmdb_marker, sizeof mmdb_marker) == 0)
+			start = p + sizeof mmdb_marker;
+	if (!start)
+		return false;
+	const mmdb_section meta{ start, static_cast<size_t>(db.view + db.size - start) };
+	const auto field{ [&meta](const char* key, unsigned* value)
+	{
+		size_t pos{};
+		mmdb_value v{};
+		if (!mmdb_find(meta, &pos, key, &v) || v.type == mmdb_string || v.type == mmdb_map || v.type == mmdb_array)
+			return false;
+		*value = static_cast<unsigned>(mmdb_unsigned(meta, v));
+		return true;
+	} };
+	if (!field("node_count", &db.node_count) || !field("record_size", &db.record_size) || !field("ip_version", &db.ip_version))
+		return false;
+	if ((db.record_size != 24 && db.record_size != 28 && db.record_size != 32) || (db.ip_version != 4 && db.ip_version != 6))
+		return false;
+	const size_t tree_size{ static_cast<size_t>(db.node_count) * db.record_size / 4 };
+	if (tree_size + mmdb_separator > static_cast<size_t>(start - sizeof mmdb_marker - db.view))
+		return false;
+	db.tree = db.view;
+	db.data = mmdb_section{ db.view + tree_size + mmdb_separator, static_cast<size_t>(start - sizeof mmdb_marker - db.view) - tree_size - mmdb_separator };
+	return true;
+}
+
+static nm mmdb_walk(mmdb_file& db, size_t* inputs)
+{
+	struct frame
+	{
+		unsigned node;
+		int depth;
+		uint128 key;
+	};
+	const nm result{ new tag_nm{} };
+	const int first{ db.ip_version == 4 ? 96 : 0 };
+	const uint128 base{ db.ip_version == 4 ? uint128_lit(0, 0x0000ffff00000000ULL) : uint128_lit(0, 0) };
+	unsigned v4{ db.node_count };
+	if (db.ip_version == 6)
+	{
+		unsigned node{};
+		for (int depth{}; depth < 96 && node < db.node_count; depth++)
+			node = mmdb_record(db, node, 0);
+		v4 = node;
+	}
+	std::vector<frame> stack{ frame{ 0, first, base } };
+	while (!stack.empty())
+	{
+		const frame f{ stack.back() };
+		stack.pop_back();
+		for (int bit{ 1 }; bit >= 0; bit--)
+		{
+			const unsigned record{ mmdb_record(db, f.node, bit) };
+			const int depth{ f.depth + 1 };
+			uint128 key{ f.key };
+			if (bit)
+				key = uint128_or(key, f.depth < 64 ? uint128_lit(1ULL << (63 - f.depth), 0) : uint128_lit(0, 1ULL << (127 - f.depth)));
+			const bool mapped{ db.ip_version == 4 || (depth >= 96 && !key.h && !(key.l >> 32)) };
+			if (record < db.node_count)
+			{
+				if (depth >= 128 || (record == v4 && !(depth == 96 && !key.h && !key.l)))
+					continue;
+				stack.push_back(frame{ record, depth, key });
+			}
+			else if (record > db.node_count && mmdb_match(db, record - db.node_count - mmdb_separator))
+			{
+				if (mapped)
+					key.l |= 0x0000ffff00000000ULL;
+				nm_push(result, key, depth, mapped ? AF_INET : AF_INET6);
+				++*inputs;
+			}
+		}
+	}
+	if (result->keys.empty())
+	{
+		nm_free(result);
+		return nullptr;
+	}
+	return result;
+}
+
+nm nm_mmdb_read(const char* path, const nm_filter* filters, const size_t count, size_t* inputs)
+{
+	mmdb_file db{};
+	nm result{};
+	LARGE_INTEGER size{};
+	*inputs = 0;
+	db.file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (db.file == INVALID_HANDLE_VALUE || !GetFileSizeEx(db.file, &size) || !size.QuadPart)
+		warn("failed to open MaxMind database \"%s\"", path);
+	else if (!((db.mapping = CreateFileMappingA(db.file, nullptr, PAGE_READONLY, 0, 0, nullptr))) ||
+		!((db.view = static_cast<const unsigned char*>(MapViewOfFile(db.mapping, FILE_MAP_READ, 0, 0, 0)))))
+		warn("failed to map MaxMind database \"%s\"", path);
+	else if (db.size = static_cast<size_t>(size.QuadPart); !mmdb_metadata(db))
+		warn("\"%s\" is not a MaxMind database", path);
+	else
+	{
+		for (size_t i{}; i < count; i++)
+		{
+			mmdb_condition c{ &filters[i] };
+			for (const char* p{ filters[i].field.c_str() };;)
+			{
+				const char* dot{ strchr(p, '.') };
+				c.path.emplace_back(p, dot ? static_cast<size_t>(dot - p) : strlen(p));
+				if (!dot)
+					break;
+				p = dot + 1;
+			}
+			db.conditions.push_back(std::move(c));
+		}
+		result = mmdb_walk(db, inputs);
+		status("%s: %zu networks from %u nodes, %zu distinct records", path, *inputs, db.node_count, db.matches.size());
+	}
+	if (db.view)
+		UnmapViewOfFile(db.view);
+	if (db.mapping)
+		CloseHandle(db.mapping);
+	if (db.file && db.file != INVALID_HANDLE_VALUE)
+		CloseHandle(db.file);
+	return result;
+}
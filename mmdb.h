@@ -0,0 +1,6 @@
+#pragma once
+#include <cstddef>
+#include "filter.h"
+#include "netmask.h"
+
+nm nm_mmdb_read(const char* path, const nm_filter*, size_t, size_t* inputs);
@@ -1,156 +1,11 @@
+#include <algorithm>
+#include <cctype>
 #include <cstdlib>
 #include <cstring>
+#include <string_view>
 #include "errors.h"
-#include "netmask.h"
-
-struct uint128
-{
-	unsigned long long h;
-	unsigned long long l;
-};
-
-static uint128 uint128_add(const uint128& x, const uint128& y, bool* carry)
-{
-	uint128 rv{ .l = x.l + y.l };
-	if (rv.l < x.l || rv.l < y.l)
-		rv.h = 1;
-	else
-		rv.h = 0;
-	rv.h += x.h + y.h;
-	if (carry)
-	{
-		if (rv.h < x.h || rv.h < y.h)
-			*carry = true;
-		else
-			*carry = false;
-	}
-	return rv;
-}
-
-static uint128 uint128_and(const uint128& x, const uint128& y)
-{
-	return uint128{ x.h & y.h, x.l & y.l };
-}
-
-static uint128 uint128_or(const uint128& x, const uint128& y)
-{
-	return uint128{ x.h | y.h, x.l | y.l };
-}
-
-static uint128 uint128_xor(const uint128& x, const uint128& y)
-{
-	return uint128{ x.h ^ y.h, x.l ^ y.l };
-}
-
-static uint128 uint128_neg(const uint128& v)
-{
-	return uint128{ ~v.h, ~v.l };
-}
-
-static uint128 uint128_lsh(const uint128& v)
-{
-	return uint128{ v.h << 1 | v.l >> 63, v.l << 1 };
-}
-
-static int uint128_cmp(const uint128& x, const uint128& y)
-{
-	if (x.h < y.h)
-		return -1;
-	if (x.h > y.h)
-		return 1;
-	if (x.l < y.l)
-		return -1;
-	if (x.l > y.l)
-		return 1;
-	return 0;
-}
-
-static uint128 uint128_of_s6(const in6_addr* s6)
-{
-	return uint128{
-		static_cast<unsigned long long>(s6->s6_addr[0]) << 56 |
-		static_cast<unsigned long long>(s6->s6_addr[1]) << 48 |
-		static_cast<unsigned long long>(s6->s6_addr[2]) << 40 |
-		static_cast<unsigned long long>(s6->s6_addr[3]) << 32 |
-		static_cast<unsigned long long>(s6->s6_addr[4]) << 24 |
-		static_cast<unsigned long long>(s6->s6_addr[5]) << 16 |
-		static_cast<unsigned long long>(s6->s6_addr[6]) << 8 |
-		static_cast<unsigned long long>(s6->s6_addr[7]) << 0,
-		static_cast<unsigned long long>(s6->s6_addr[8]) << 56 |
-		static_cast<unsigned long long>(s6->s6_addr[9]) << 48 |
-		static_cast<unsigned long long>(s6->s6_addr[10]) << 40 |
-		static_cast<unsigned long long>(s6->s6_addr[11]) << 32 |
-		static_cast<unsigned long long>(s6->s6_addr[12]) << 24 |
-		static_cast<unsigned long long>(s6->s6_addr[13]) << 16 |
-		static_cast<unsigned long long>(s6->s6_addr[14]) << 8 |
-		static_cast<unsigned long long>(s6->s6_addr[15]) << 0
-	};
-}
-
-static in6_addr s6_of_u128(const uint128& v)
-{
-	in6_addr s6{};
-	s6.s6_addr[0] = 0xff & v.h >> 56;
-	s6.s6_addr[1] = 0xff & v.h >> 48;
-	s6.s6_addr[2] = 0xff & v.h >> 40;
-	s6.s6_addr[3] = 0xff & v.h >> 32;
-	s6.s6_addr[4] = 0xff & v.h >> 24;
-	s6.s6_addr[5] = 0xff & v.h >> 16;
-	s6.s6_addr[6] = 0xff & v.h >> 8;
-	s6.s6_addr[7] = 0xff & v.h >> 0;
-	s6.s6_addr[8] = 0xff & v.l >> 56;
-	s6.s6_addr[9] = 0xff & v.l >> 48;
-	s6.s6_addr[10] = 0xff & v.l >> 40;
-	s6.s6_addr[11] = 0xff & v.l >> 32;
-	s6.s6_addr[12] = 0xff & v.l >> 24;
-	s6.s6_addr[13] = 0xff & v.l >> 16;
-	s6.s6_addr[14] = 0xff & v.l >> 8;
-	s6.s6_addr[15] = 0xff & v.l >> 0;
-	return s6;
-}
-
-static uint128 uint128_lit(const unsigned long long h, const unsigned long long l)
-{
-	return uint128{ h, l };
-}
-
-static uint128 uint128_cidr(const unsigned char n)
-{
-	// ReSharper disable once CppInitializedValueIsAlwaysRewritten
-	uint128 rv{};
-	if (n <= 0) {
-		rv.h = 0;
-		rv.l = 0;
-	}
-	else if (n <= 64)
-	{
-		// ReSharper disable CppRedundantParentheses
-		rv.h = ~0ULL << (64 - n);
-		rv.l = 0;
-	}
-	else if (n <= 128)
-	{
-		rv.h = ~0ULL;
-		rv.l = ~0ULL << (128 - n);
-		// ReSharper restore CppRedundantParentheses
-	}
-	else
-	{
-		rv.h = ~0ULL;
-		rv.l = ~0ULL;
-	}
-	return rv;
-}
-
-static int cidr(const uint128& u)
-{
-	int n{};
-	for (unsigned long long v{ u.l }; v > 0; v <<= 1)
-		n++;
-	for (unsigned long long v{ u.h }; v > 0; v <<= 1)
-		n++;
-	return n;
-}
+#include "netmask_int.h"
+#include "radix.h"
 
 static int check_mask(const uint128& v)
 {
@@ -164,14 +19,6 @@ static int check_mask(const uint128& v)
 	return 0;
 }
 
-struct tag_nm
-{
-	uint128 net_address;
-	uint128 mask;
-	int domain;
-	nm next;
-};
-
 nm nm_new_v4(const in_addr* s)
 {
 	const union
@@ -180,29 +27,31 @@ nm nm_new_v4(const in_addr* s)
 		unsigned u32[4]{};
 	} v{ .u32 = { 0, 0, htonl(0x0000ffff), s->s_addr } };
 	const nm self{ nm_new_v6(&v.s6) };
-	self->domain = AF_INET;
+	self->families[0] = false;
 	return self;
 }
 
 nm nm_new_v6(const in6_addr* s6)
 {
-	return new tag_nm{ uint128_of_s6(s6), uint128_cidr(128), AF_INET6, nullptr };
+	const nm self{ new tag_nm{} };
+	nm_push(self, uint128_of_s6(s6), 128, AF_INET6);
+	return self;
 }
 
-static int subset_of(const nm a, const nm b)
+static int subset_of(const uint128& a, const int a_length, const uint128& b, const int b_length)
 {
-	return uint128_cmp(a->mask, b->mask) >= 0 && uint128_cmp(b->net_address, uint128_and(a->net_address, b->mask)) == 0;
+	return a_length >= b_length && uint128_cmp(b, uint128_and(a, uint128_cidr(static_cast<unsigned char>(b_length)))) == 0;
 }
 
-static int joinable_pair(const nm a, const nm b)
+static int joinable_pair(const tag_nm* self, const size_t a, const size_t b)
 {
-	return uint128_cmp(a->mask, b->mask) == 0 && uint128_cmp(a->net_address, b->net_address) != 0 && uint128_cmp(uint128_lit(0, 0), uint128_and(uint128_xor(a->net_address, b->net_address), uint128_lsh(a->mask))) == 0;
+	const uint128 mask{ uint128_cidr(self->lengths[a]) };
+	return self->lengths[a] == self->lengths[b] && uint128_cmp(self->keys[a], self->keys[b]) != 0 && uint128_cmp(uint128_lit(0, 0), uint128_and(uint128_xor(self->keys[a], self->keys[b]), uint128_lsh(mask))) == 0;
 }
 
-static int is_v4(const nm self)
+int is_v4(const uint128& net_address, const int length, const int domain)
 {
-	tag_nm v4_map{ uint128_lit(0, 0x0000ffff00000000ULL), uint128_cidr(96), {}, {} };
-	return self->domain == AF_INET && subset_of(self, &v4_map);
+	return domain == AF_INET && subset_of(net_address, length, uint128_lit(0, 0x0000ffff00000000ULL), 96);
 }
 
 nm nm_new_ai(const addrinfo* ai)
@@ -222,6 +71,7 @@ nm nm_new_ai(const addrinfo* ai)
 			panic("unknown ai_family %d in struct addrinfo", cur->ai_family);
 		}
 	}
+	nm_normalize(self);
 	return self;
 }
 
@@ -253,9 +103,10 @@ static int parse_mask(const nm self, const char* str, const int flags)
 	unsigned v{ strtoul(str, &p, 0) };
 	in6_addr s6{};
 	in_addr s{};
+	uint128 mask{ uint128_cidr(self->lengths[0]) };
 	if (*p == '\0')
 	{
-		if (is_v4(self))
+		if (is_v4(self->keys[0], self->lengths[0], nm_domain(self, 0)))
 		{
 			if (v > 32)
 				return 0;
@@ -263,56 +114,53 @@ static int parse_mask(const nm self, const char* str, const int flags)
 		}
 		else if (v > 128)
 			return 0;
-		self->mask = uint128_cidr(static_cast<unsigned char>(v));
+		mask = uint128_cidr(static_cast<unsigned char>(v));
 	}
 	else if (inet_pton(AF_INET6, str, &s6))
 	{
-		self->mask = uint128_of_s6(&s6);
-		if (uint128_cmp(uint128_lit(0, 0), uint128_and(uint128_lit(1ULL << 63, 1), uint128_xor(uint128_lit(0, 1), self->mask))) == 0)
-			self->mask = uint128_neg(self->mask);
-		self->domain = AF_INET6;
+		mask = uint128_of_s6(&s6);
+		if (uint128_cmp(uint128_lit(0, 0), uint128_and(uint128_lit(1ULL << 63, 1), uint128_xor(uint128_lit(0, 1), mask))) == 0)
+			mask = uint128_neg(mask);
+		self->families[0] = true;
 	}
-	else if (self->domain == AF_INET && inet_pton(AF_INET, str, &s))
+	else if (nm_domain(self, 0) == AF_INET && inet_pton(AF_INET, str, &s))
 	{
 		v = htonl(s.s_addr);
 		if (v & 1 && ~v >> 31)
 			v = ~v;
-		self->mask = uint128_xor(self->mask, uint128_lit(0, ~v));
+		mask = uint128_xor(mask, uint128_lit(0, ~v));
 	}
 	else
 		return 0;
-	if (!check_mask(self->mask))
+	if (!check_mask(mask))
 		return 0;
-	self->net_address = uint128_and(self->net_address, self->mask);
+	self->keys[0] = uint128_and(self->keys[0], mask);
+	self->lengths[0] = static_cast<unsigned char>(cidr(mask));
+	self->normalized = false;
 	return 1;
 }
 
-static int nm_widen(const nm self, const uint128& max, uint128* last)
+void nm_range(const nm self, const uint128& low, const uint128& high, const int domain)
 {
-	uint128 mask{}, net_address{}, broadcast{};
-	int cmp{ uint128_cmp(self->net_address, max) };
-	while (cmp < 0)
-	{
-		mask = uint128_lsh(self->mask);
-		net_address = uint128_and(self->net_address, mask);
-		broadcast = uint128_or(self->net_address, uint128_neg(mask));
-		if (uint128_cmp(net_address, self->net_address) < 0)
-			break;
-		cmp = uint128_cmp(broadcast, max);
-		if (cmp > 0)
-			break;
-		self->mask = mask;
-		*last = broadcast;
-		status("widen %016llx %016llx/%d", self->net_address.h, self->net_address.l, cidr(self->mask));
-		if (cmp == 0)
+	const uint128 one{ uint128_lit(0, 1) };
+	uint128 net_address{ low };
+	for (;;)
+	{
+		bool carry{};
+		const uint128 count{ uint128_add(uint128_sub(high, net_address, nullptr), one, &carry) };
+		const int bits{ carry ? 128 : std::min(uint128_ctz(net_address), uint128_width(count) - 1) };
+		const uint128 last{ uint128_or(net_address, uint128_neg(uint128_cidr(static_cast<unsigned char>(128 - bits)))) };
+		nm_push(self, net_address, 128 - bits, domain);
+		status("range %016llx %016llx/%d", net_address.h, net_address.l, 128 - bits);
+		if (uint128_cmp(last, high) >= 0)
 			break;
+		net_address = uint128_add(last, one, nullptr);
 	}
-	return cmp;
 }
 
 static void nm_order(nm* low, nm* high)
 {
-	if (uint128_cmp((*low)->net_address, (*high)->net_address) > 0)
+	if (uint128_cmp((*low)->keys[0], (*high)->keys[0]) > 0)
 	{
 		const nm t{ *low };
 		*low = *high;
@@ -323,21 +171,17 @@ static void nm_order(nm* low, nm* high)
 static nm nm_seq(nm first, nm last)
 {
 	nm_order(&first, &last);
-	nm cur{ first };
-	uint128 pos{ cur->net_address };
-	const uint128 max{ last->net_address };
-	const uint128 one{ uint128_lit(0, 1) };
-	const int domain{ is_v4(first) && is_v4(last) ? AF_INET : AF_INET6 };
-	delete last;
-	while (nm_widen(cur, max, &pos))
-	{
-		cur->next = new tag_nm{ uint128_add(pos, one, nullptr), uint128_cidr(128), domain, nullptr };
-		cur = cur->next;
-	}
+	const uint128 low{ first->keys[0] }, high{ last->keys[0] };
+	const int head{ nm_domain(first, 0) };
+	const int domain{ is_v4(low, first->lengths[0], head) && is_v4(high, last->lengths[0], nm_domain(last, 0)) ? AF_INET : AF_INET6 };
+	nm_free(last);
+	*first = tag_nm{};
+	nm_range(first, low, high, domain);
+	first->families[0] = head != AF_INET;
 	return first;
 }
 
-nm nm_new_str(const char* str, const int flags)
+static nm nm_new_name(const char* str, const int flags)
 {
 	const char* p;
 	char buf[2048]{};
@@ -351,7 +195,7 @@ nm nm_new_str(const char* str, const int flags)
 			return nullptr;
 		if (!parse_mask(self, p + 1, flags))
 		{
-			delete self;
+			nm_free(self);
 			return nullptr;
 		}
 		return self;
@@ -371,19 +215,19 @@ nm nm_new_str(const char* str, const int flags)
 		const nm top{ parse_address(p + add + 1, flags) };
 		if (!top)
 		{
-			delete self;
+			nm_free(self);
 			return nullptr;
 		}
 		if (add)
 		{
 			bool carry{};
-			if (is_v4(top))
-				top->net_address.l &= 0xffffffffULL;
-			top->net_address = uint128_add(self->net_address, top->net_address, &carry);
+			if (is_v4(top->keys[0], top->lengths[0], nm_domain(top, 0)))
+				top->keys[0].l &= 0xffffffffULL;
+			top->keys[0] = uint128_add(self->keys[0], top->keys[0], &carry);
 			if (carry)
 			{
-				delete self;
-				delete top;
+				nm_free(self);
+				nm_free(top);
 				return nullptr;
 			}
 		}
@@ -408,14 +252,14 @@ nm nm_new_str(const char* str, const int flags)
 				// ReSharper disable once CppInitializedValueIsAlwaysRewritten
 				in_addr s{};
 				char* end{};
-				const unsigned long long v{ self->net_address.l + strtoull(p + 2, &end, 0) };
+				const unsigned long long v{ self->keys[0].l + strtoull(p + 2, &end, 0) };
 				if (*end == '\0')
 				{
 					s.s_addr = htonl(static_cast<unsigned long>(v));
 					top = nm_new_v4(&s);
 					if (!top)
 					{
-						delete self;
+						nm_free(self);
 						return nullptr;
 					}
 					return nm_seq(self, top);
@@ -427,19 +271,19 @@ nm nm_new_str(const char* str, const int flags)
 		top = parse_address(p + add + 1, flags);
 		if (!top)
 		{
-			delete self;
+			nm_free(self);
 			return nullptr;
 		}
 		if (add)
 		{
 			bool carry{};
-			if (is_v4(top))
-				top->net_address.l &= 0xffffffffULL;
-			top->net_address = uint128_add(self->net_address, top->net_address, &carry);
+			if (is_v4(top->keys[0], top->lengths[0], nm_domain(top, 0)))
+				top->keys[0].l &= 0xffffffffULL;
+			top->keys[0] = uint128_add(self->keys[0], top->keys[0], &carry);
 			if (carry)
 			{
-				delete self;
-				delete top;
+				nm_free(self);
+				nm_free(top);
 				return nullptr;
 			}
 		}
@@ -448,67 +292,465 @@ nm nm_new_str(const char* str, const int flags)
 	return nullptr;
 }
 
-nm nm_merge(nm dst, nm src) {
-	nm tmp;
-	nm* pos{ &dst };
-	while (src) {
-		if (*pos == nullptr) {  // NOLINT(bugprone-branch-clone)
-			tmp = src;
-			src = *pos;
-			*pos = tmp;
+static int hex_value(const char c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F')
+		return c - 'A' + 10;
+	return -1;
+}
+
+static bool scan_number(const std::string_view str, unsigned long long* out)
+{
+	size_t i{};
+	while (i < str.size() && isspace(static_cast<unsigned char>(str[i])))
+		i++;
+	bool negate{};
+	if (i < str.size() && (str[i] == '+' || str[i] == '-'))
+		negate = str[i++] == '-';
+	int base{ 10 };
+	if (i + 2 < str.size() && str[i] == '0' && (str[i + 1] == 'x' || str[i + 1] == 'X') && hex_value(str[i + 2]) >= 0)
+	{
+		base = 16;
+		i += 2;
+	}
+	else if (i < str.size() && str[i] == '0')
+		base = 8;
+	unsigned long long v{};
+	bool overflow{};
+	size_t digits{};
+	for (; i < str.size(); i++, digits++)
+	{
+		const int d{ hex_value(str[i]) };
+		if (d < 0 || d >= base)
+			break;
+		if (v > (~0ULL - d) / base)
+			overflow = true;
+		else
+			v = v * base + d;
+	}
+	if (!digits)
+	{
+		*out = 0;
+		return str.empty();
+	}
+	if (i != str.size())
+		return false;
+	*out = overflow ? ~0ULL : negate ? 0 - v : v;
+	return true;
+}
+
+static bool scan_v4(const std::string_view str, unsigned* out)
+{
+	unsigned v{}, octet{}, octets{};
+	bool digit{};
+	for (const char c : str)
+	{
+		if (c >= '0' && c <= '9')
+		{
+			if (digit && octet == 0)
+				return false;
+			octet = octet * 10 + (c - '0');
+			if (octet > 255)
+				return false;
+			if (!digit)
+			{
+				if (++octets > 4)
+					return false;
+				digit = true;
+			}
 		}
-		else if (subset_of(src, *pos)) {
-			status("found %016llx %016llx/%d a subset of %016llx %016llx/%d", src->net_address.h, src->net_address.l, cidr(src->mask), (*pos)->net_address.h, (*pos)->net_address.l, cidr((*pos)->mask));
-			if (src->domain != AF_INET)
-				(*pos)->domain = src->domain;
-			tmp = src;
-			src = src->next;
-			free(tmp);
+		else if (c == '.' && digit)
+		{
+			if (octets == 4)
+				return false;
+			v = v << 8 | octet;
+			octet = 0;
+			digit = false;
 		}
-		else if (subset_of(*pos, src)) {
-			tmp = src;
-			src = *pos;
-			*pos = tmp;
+		else
+			return false;
+	}
+	if (octets < 4)
+		return false;
+	*out = v << 8 | octet;
+	return true;
+}
+
+static bool scan_v6(const std::string_view str, uint128* out)
+{
+	constexpr size_t size{ sizeof(in6_addr) };
+	in6_addr s6{};
+	size_t pos{}, tp{}, colon{ size + 1 }, digits{};
+	unsigned v{};
+	if (str.empty())
+		return false;
+	if (str[0] == ':')
+	{
+		if (str.size() < 2 || str[1] != ':')
+			return false;
+		pos = 1;
+	}
+	size_t token{ pos };
+	while (pos < str.size())
+	{
+		const char c{ str[pos++] };
+		if (const int d{ hex_value(c) }; d >= 0)
+		{
+			if (digits == 4)
+				return false;
+			v = v << 4 | d;
+			digits++;
+			continue;
 		}
-		else if (joinable_pair(src, *pos)) {
-			status("joinable %016llx %016llx/%d and %016llx %016llx/%d", src->net_address.h, src->net_address.l, cidr(src->mask), (*pos)->net_address.h, (*pos)->net_address.l, cidr((*pos)->mask));
-			tmp = *pos;
-			*pos = (*pos)->next;
-			if (src->domain == AF_INET)
-				src->domain = tmp->domain;
-			free(tmp);
-			src->mask = uint128_lsh(src->mask);
-			src->net_address = uint128_and(src->net_address, src->mask);
-			tmp = src->next;
-			src->next = nullptr;
-			src = nm_merge(src, tmp);
-			pos = &dst;
+		if (c == ':')
+		{
+			token = pos;
+			if (!digits)
+			{
+				if (colon <= size)
+					return false;
+				colon = tp;
+				continue;
+			}
+			if (pos == str.size() || tp + 2 > size)
+				return false;
+			s6.s6_addr[tp++] = static_cast<unsigned char>(v >> 8);
+			s6.s6_addr[tp++] = static_cast<unsigned char>(v);
+			digits = 0;
+			v = 0;
+			continue;
 		}
-		else if (uint128_cmp(src->net_address, (*pos)->net_address) < 0) {
-			tmp = src;
-			src = *pos;
-			*pos = tmp;
+		unsigned s{};
+		if (c == '.' && tp + 4 <= size && scan_v4(str.substr(token), &s))
+		{
+			for (int shift{ 24 }; shift >= 0; shift -= 8)
+				s6.s6_addr[tp++] = static_cast<unsigned char>(s >> shift);
+			digits = 0;
+			break;
 		}
-		else
-			pos = &(*pos)->next;
+		return false;
 	}
+	if (digits)
+	{
+		if (tp + 2 > size)
+			return false;
+		s6.s6_addr[tp++] = static_cast<unsigned char>(v >> 8);
+		s6.s6_addr[tp++] = static_cast<unsigned char>(v);
+	}
+	if (colon <= size)
+	{
+		if (tp == size)
+			return false;
+		memmove(s6.s6_addr + size - (tp - colon), s6.s6_addr + colon, tp - colon);
+		memset(s6.s6_addr + colon, 0, size - tp);
+		tp = size;
+	}
+	if (tp != size)
+		return false;
+	*out = uint128_of_s6(&s6);
+	return true;
+}
+
+static bool scan_address(const std::string_view str, uint128* key, bool* v6)
+{
+	unsigned s{};
+	if (scan_v6(str, key))
+		*v6 = true;
+	else if (scan_v4(str, &s))
+	{
+		*key = uint128_lit(0, 0x0000ffff00000000ULL | s);
+		*v6 = false;
+	}
+	else
+		return false;
+	return true;
+}
+
+static int spec_mask(nm_spec* spec, const uint128& key, const std::string_view str)
+{
+	unsigned long long v{};
+	unsigned s{};
+	uint128 mask{};
+	if (scan_number(str, &v))
+	{
+		if (!spec->v6)
+		{
+			if (v > 32)
+				return nm_parse_mask;
+			v += 96;
+		}
+		else if (v > 128)
+			return nm_parse_mask;
+		mask = uint128_cidr(static_cast<unsigned char>(v));
+	}
+	else if (scan_v6(str, &mask))
+	{
+		if (uint128_cmp(uint128_lit(0, 0), uint128_and(uint128_lit(1ULL << 63, 1), uint128_xor(uint128_lit(0, 1), mask))) == 0)
+			mask = uint128_neg(mask);
+		spec->v6 = true;
+	}
+	else if (!spec->v6 && scan_v4(str, &s))
+	{
+		if (s & 1 && ~s >> 31)
+			s = ~s;
+		mask = uint128_lit(~0ULL, 0xffffffff00000000ULL | s);
+	}
+	else
+		return nm_parse_mask;
+	if (!check_mask(mask))
+		return nm_parse_mask;
+	spec->low = uint128_and(key, mask);
+	spec->high = uint128_or(spec->low, uint128_neg(mask));
+	spec->domain = spec->v6 ? AF_INET6 : AF_INET;
+	return nm_parse_ok;
+}
+
+static int spec_range(nm_spec* spec, const uint128& key, const bool v6, uint128 top, const bool top_v6, const bool add)
+{
+	if (add)
+	{
+		bool carry{};
+		if (!top_v6)
+			top.l &= 0xffffffffULL;
+		top = uint128_add(key, top, &carry);
+		if (carry)
+			return nm_parse_overflow;
+	}
+	const bool swap{ uint128_cmp(key, top) > 0 };
+	spec->low = swap ? top : key;
+	spec->high = swap ? key : top;
+	spec->v6 = swap ? top_v6 : v6;
+	spec->domain = is_v4(key, 128, v6 ? AF_INET6 : AF_INET) && is_v4(top, 128, top_v6 ? AF_INET6 : AF_INET) ? AF_INET : AF_INET6;
+	return nm_parse_ok;
+}
+
+int nm_parse(const std::string_view str, nm_spec* spec)
+{
+	uint128 key{}, top{};
+	bool top_v6{};
+	size_t p;
+	if ((p = str.find('/')) != std::string_view::npos)
+	{
+		if (!scan_address(str.substr(0, p), &key, &spec->v6))
+			return nm_parse_name;
+		return spec_mask(spec, key, str.substr(p + 1));
+	}
+	if ((p = str.find(',')) != std::string_view::npos)
+	{
+		const std::string_view rest{ str.substr(p + 1) };
+		const bool add{ rest.starts_with('+') };
+		if (!scan_address(str.substr(0, p), &key, &spec->v6) || !scan_address(rest.substr(add), &top, &top_v6))
+			return nm_parse_name;
+		return spec_range(spec, key, spec->v6, top, top_v6, add);
+	}
+	if (scan_address(str, &key, &spec->v6))
+	{
+		spec->low = spec->high = key;
+		spec->domain = spec->v6 ? AF_INET6 : AF_INET;
+		return nm_parse_ok;
+	}
+	if ((p = str.find(':')) == std::string_view::npos || !scan_address(str.substr(0, p), &key, &spec->v6))
+		return nm_parse_name;
+	const std::string_view rest{ str.substr(p + 1) };
+	const bool add{ rest.starts_with('+') };
+	if (unsigned long long n{}; rest.starts_with("+-") && scan_number(rest.substr(1), &n))
+		return spec_range(spec, key, spec->v6, uint128_lit(0, 0x0000ffff00000000ULL | static_cast<unsigned>(key.l + n)), false, false);
+	if (!scan_address(rest.substr(add), &top, &top_v6))
+		return nm_parse_name;
+	return spec_range(spec, key, spec->v6, top, top_v6, add);
+}
+
+void nm_spec_push(const nm self, const nm_spec& spec)
+{
+	const size_t first{ self->keys.size() };
+	nm_range(self, spec.low, spec.high, spec.domain);
+	self->families[first] = spec.v6;
+}
+
+nm nm_new_str(const char* str, const int flags)
+{
+	nm_spec spec{};
+	const int rv{ nm_parse(str, &spec) };
+	if (rv == nm_parse_name && nm_use_dns & flags)
+		return nm_new_name(str, flags);
+	if (rv != nm_parse_ok)
+		return nullptr;
+	const nm self{ new tag_nm{} };
+	nm_spec_push(self, spec);
+	return self;
+}
+
+nm nm_merge(const nm dst, const nm src) {
+	if (!dst)
+		return src;
+	if (!src)
+		return dst;
+	dst->keys.insert(dst->keys.end(), src->keys.begin(), src->keys.end());
+	dst->lengths.insert(dst->lengths.end(), src->lengths.begin(), src->lengths.end());
+	dst->families.insert(dst->families.end(), src->families.begin(), src->families.end());
+	dst->normalized = false;
+	delete src;
 	return dst;
 }
 
-void nm_walk(nm self, void (*cb)(int, const nm_address*, nm_address*)) {
+void nm_append(const nm self, const uint128& net_address, const int length, const bool v6)
+{
+	if (!self->keys.empty() && subset_of(net_address, length, self->keys.back(), self->lengths.back()))
+	{
+		status("found %016llx %016llx/%d a subset of %016llx %016llx/%d", net_address.h, net_address.l, length, self->keys.back().h, self->keys.back().l, self->lengths.back());
+		if (v6)
+			self->families.back() = true;
+		return;
+	}
+	nm_push(self, net_address, length, v6 ? AF_INET6 : AF_INET);
+	for (size_t n{ self->keys.size() }; n >= 2 && joinable_pair(self, n - 2, n - 1); n--)
+	{
+		status("joinable %016llx %016llx/%d and %016llx %016llx/%d", self->keys[n - 2].h, self->keys[n - 2].l, self->lengths[n - 2], self->keys[n - 1].h, self->keys[n - 1].l, self->lengths[n - 1]);
+		if (self->families.back())
+			self->families[n - 2] = true;
+		self->keys.pop_back();
+		self->lengths.pop_back();
+		self->families.pop_back();
+		self->lengths.back()--;
+	}
+}
+
+void nm_normalize(const nm self)
+{
+	if (!self || self->normalized)
+		return;
+	std::vector<nm_sort_item> order(self->keys.size());
+	for (size_t i{}; i < order.size(); i++)
+		order[i] = nm_sort_item{ self->keys[i], self->lengths[i], self->families[i] };
+	nm_radix_sort(order.data(), order.size(), 0);
+	tag_nm out{};
+	out.keys.reserve(order.size());
+	out.lengths.reserve(order.size());
+	out.families.reserve(order.size());
+	for (const nm_sort_item& item : order)
+		nm_append(&out, item.key, item.length, item.v6);
+	out.normalized = true;
+	*self = std::move(out);
+}
+
+struct nm_span
+{
+	uint128 low;
+	uint128 high;
 	int domain;
-	nm_address net_address{}, mask{};
-	while (self) {
-		net_address.s6 = s6_of_u128(self->net_address);
-		mask.s6 = s6_of_u128(self->mask);
-		if (is_v4(self)) {
-			domain = AF_INET;
-			net_address.s.s_addr = htonl(net_address.s6.s6_addr[12] << 24 | net_address.s6.s6_addr[13] << 16 | net_address.s6.s6_addr[14] << 8 | net_address.s6.s6_addr[15] << 0);
-			mask.s.s_addr = htonl(mask.s6.s6_addr[12] << 24 | mask.s6.s6_addr[13] << 16 | mask.s6.s6_addr[14] << 8 | mask.s6.s6_addr[15] << 0);
+};
+
+static uint128 nm_broadcast(const tag_nm* self, const size_t i)
+{
+	return uint128_or(self->keys[i], uint128_neg(uint128_cidr(self->lengths[i])));
+}
+
+static int nm_span_next(const tag_nm* self, size_t* cur, nm_span* span)
+{
+	if (!self || *cur >= self->keys.size())
+		return 0;
+	const uint128 one{ uint128_lit(0, 1) };
+	*span = nm_span{ self->keys[*cur], nm_broadcast(self, *cur), nm_domain(self, *cur) };
+	for (++*cur; *cur < self->keys.size(); ++*cur)
+	{
+		bool carry{};
+		if (uint128_cmp(uint128_add(span->high, one, &carry), self->keys[*cur]) != 0 || carry)
+			break;
+		span->high = nm_broadcast(self, *cur);
+		if (span->domain == AF_INET)
+			span->domain = nm_domain(self, *cur);
+	}
+	return 1;
+}
+
+void nm_delta(const nm from, const nm to, nm* add, nm* del)
+{
+	const uint128 one{ uint128_lit(0, 1) };
+	nm_span a{}, b{};
+	size_t from_cur{}, to_cur{};
+	nm_normalize(from);
+	nm_normalize(to);
+	*add = new tag_nm{};
+	*del = new tag_nm{};
+	int has_a{ nm_span_next(from, &from_cur, &a) }, has_b{ nm_span_next(to, &to_cur, &b) };
+	while (has_a || has_b)
+	{
+		if (has_a && (!has_b || uint128_cmp(a.high, b.low) < 0))
+		{
+			nm_range(*del, a.low, a.high, a.domain);
+			has_a = nm_span_next(from, &from_cur, &a);
+		}
+		else if (has_b && (!has_a || uint128_cmp(b.high, a.low) < 0))
+		{
+			nm_range(*add, b.low, b.high, b.domain);
+			has_b = nm_span_next(to, &to_cur, &b);
+		}
+		else if (const int cmp{ uint128_cmp(a.low, b.low) }; cmp < 0)
+		{
+			nm_range(*del, a.low, uint128_sub(b.low, one, nullptr), a.domain);
+			a.low = b.low;
+		}
+		else if (cmp > 0)
+		{
+			nm_range(*add, b.low, uint128_sub(a.low, one, nullptr), b.domain);
+			b.low = a.low;
+		}
+		else if (const int end{ uint128_cmp(a.high, b.high) }; end < 0)
+		{
+			b.low = uint128_add(a.high, one, nullptr);
+			has_a = nm_span_next(from, &from_cur, &a);
+		}
+		else if (end > 0)
+		{
+			a.low = uint128_add(b.high, one, nullptr);
+			has_b = nm_span_next(to, &to_cur, &b);
 		}
 		else
-			domain = AF_INET6;
-		cb(domain, &net_address, &mask);
-		self = self->next;
+		{
+			has_a = nm_span_next(from, &from_cur, &a);
+			has_b = nm_span_next(to, &to_cur, &b);
+		}
 	}
 }
+
+void nm_visit(const uint128& net_address, const int length, const int domain, void (*cb)(int, const nm_address*, nm_address*)) {
+	int v4;
+	nm_address n{}, mask{};
+	n.s6 = s6_of_u128(net_address);
+	mask.s6 = s6_of_u128(uint128_cidr(static_cast<unsigned char>(length)));
+	if (is_v4(net_address, length, domain)) {
+		v4 = AF_INET;
+		n.s.s_addr = htonl(n.s6.s6_addr[12] << 24 | n.s6.s6_addr[13] << 16 | n.s6.s6_addr[14] << 8 | n.s6.s6_addr[15] << 0);
+		mask.s.s_addr = htonl(mask.s6.s6_addr[12] << 24 | mask.s6.s6_addr[13] << 16 | mask.s6.s6_addr[14] << 8 | mask.s6.s6_addr[15] << 0);
+	}
+	else
+		v4 = AF_INET6;
+	cb(v4, &n, &mask);
+}
+
+void nm_walk(const nm self, void (*cb)(int, const nm_address*, nm_address*)) {
+	nm_walk_range(self, 0, nm_size(self), cb);
+}
+
+size_t nm_size(const nm self) {
+	if (!self)
+		return 0;
+	nm_normalize(self);
+	return self->keys.size();
+}
+
+void nm_walk_range(const nm self, const size_t first, const size_t last, void (*cb)(int, const nm_address*, nm_address*)) {
+	if (!self)
+		return;
+	nm_normalize(self);
+	for (size_t i{ first }; i < last && i < self->keys.size(); i++)
+		nm_visit(self->keys[i], self->lengths[i], nm_domain(self, i), cb);
+}
+
+void nm_free(const nm self) {
+	delete self;
+}
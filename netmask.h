@@ -12,6 +12,9 @@ nm nm_new_v6(const in6_addr*);
 nm nm_new_ai(const addrinfo*);
 nm nm_new_str(const char*, int flags);
 nm nm_merge(nm, nm);
+nm nm_merge_sorted(nm*, size_t); // takes ownership of the lists and sets them to nullptr
+void nm_delta(nm, nm, nm*, nm*);
+nm nm_approximate(nm, size_t, in6_addr*);
 
 union nm_address
 {
@@ -20,3 +23,6 @@ union nm_address
 };
 
 void nm_walk(nm, void(*)(int, const nm_address*, nm_address*));
+size_t nm_size(nm);
+void nm_walk_range(nm, size_t first, size_t last, void(*)(int, const nm_address*, nm_address*));
+void nm_free(nm);
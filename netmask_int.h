@@ -0,0 +1,225 @@
+#pragma once
+#include <bit>
+#include <string_view>
+#include <vector>
+#include "netmask.h"
+
+struct uint128
+{
+	unsigned long long h;
+	unsigned long long l;
+};
+
+inline uint128 uint128_add(const uint128& x, const uint128& y, bool* carry)
+{
+	uint128 rv{ .l = x.l + y.l };
+	if (rv.l < x.l || rv.l < y.l)
+		rv.h = 1;
+	else
+		rv.h = 0;
+	rv.h += x.h + y.h;
+	if (carry)
+	{
+		if (rv.h < x.h || rv.h < y.h)
+			*carry = true;
+		else
+			*carry = false;
+	}
+	return rv;
+}
+
+inline uint128 uint128_sub(const uint128& x, const uint128& y, bool* borrow)
+{
+	const uint128 rv{ x.h - y.h - (x.l < y.l), x.l - y.l };
+	if (borrow)
+		*borrow = x.h < y.h || (x.h == y.h && x.l < y.l);
+	return rv;
+}
+
+inline uint128 uint128_and(const uint128& x, const uint128& y)
+{
+	return uint128{ x.h & y.h, x.l & y.l };
+}
+
+inline uint128 uint128_or(const uint128& x, const uint128& y)
+{
+	return uint128{ x.h | y.h, x.l | y.l };
+}
+
+inline uint128 uint128_xor(const uint128& x, const uint128& y)
+{
+	return uint128{ x.h ^ y.h, x.l ^ y.l };
+}
+
+inline uint128 uint128_neg(const uint128& v)
+{
+	return uint128{ ~v.h, ~v.l };
+}
+
+inline uint128 uint128_lsh(const uint128& v)
+{
+	return uint128{ v.h << 1 | v.l >> 63, v.l << 1 };
+}
+
+inline int uint128_cmp(const uint128& x, const uint128& y)
+{
+	if (x.h < y.h)
+		return -1;
+	if (x.h > y.h)
+		return 1;
+	if (x.l < y.l)
+		return -1;
+	if (x.l > y.l)
+		return 1;
+	return 0;
+}
+
+inline int uint128_ctz(const uint128& v)
+{
+	return v.l ? std::countr_zero(v.l) : 64 + std::countr_zero(v.h);
+}
+
+inline int uint128_width(const uint128& v)
+{
+	return v.h ? 64 + std::bit_width(v.h) : std::bit_width(v.l);
+}
+
+inline uint128 uint128_of_s6(const in6_addr* s6)
+{
+	return uint128{
+		static_cast<unsigned long long>(s6->s6_addr[0]) << 56 |
+		static_cast<unsigned long long>(s6->s6_addr[1]) << 48 |
+		static_cast<unsigned long long>(s6->s6_addr[2]) << 40 |
+		static_cast<unsigned long long>(s6->s6_addr[3]) << 32 |
+		static_cast<unsigned long long>(s6->s6_addr[4]) << 24 |
+		static_cast<unsigned long long>(s6->s6_addr[5]) << 16 |
+		static_cast<unsigned long long>(s6->s6_addr[6]) << 8 |
+		static_cast<unsigned long long>(s6->s6_addr[7]) << 0,
+		static_cast<unsigned long long>(s6->s6_addr[8]) << 56 |
+		static_cast<unsigned long long>(s6->s6_addr[9]) << 48 |
+		static_cast<unsigned long long>(s6->s6_addr[10]) << 40 |
+		static_cast<unsigned long long>(s6->s6_addr[11]) << 32 |
+		static_cast<unsigned long long>(s6->s6_addr[12]) << 24 |
+		static_cast<unsigned long long>(s6->s6_addr[13]) << 16 |
+		static_cast<unsigned long long>(s6->s6_addr[14]) << 8 |
+		static_cast<unsigned long long>(s6->s6_addr[15]) << 0
+	};
+}
+
+inline in6_addr s6_of_u128(const uint128& v)
+{
+	in6_addr s6{};
+	s6.s6_addr[0] = 0xff & v.h >> 56;
+	s6.s6_addr[1] = 0xff & v.h >> 48;
+	s6.s6_addr[2] = 0xff & v.h >> 40;
+	s6.s6_addr[3] = 0xff & v.h >> 32;
+	s6.s6_addr[4] = 0xff & v.h >> 24;
+	s6.s6_addr[5] = 0xff & v.h >> 16;
+	s6.s6_addr[6] = 0xff & v.h >> 8;
+	s6.s6_addr[7] = 0xff & v.h >> 0;
+	s6.s6_addr[8] = 0xff & v.l >> 56;
+	s6.s6_addr[9] = 0xff & v.l >> 48;
+	s6.s6_addr[10] = 0xff & v.l >> 40;
+	s6.s6_addr[11] = 0xff & v.l >> 32;
+	s6.s6_addr[12] = 0xff & v.l >> 24;
+	s6.s6_addr[13] = 0xff & v.l >> 16;
+	s6.s6_addr[14] = 0xff & v.l >> 8;
+	s6.s6_addr[15] = 0xff & v.l >> 0;
+	return s6;
+}
+
+inline uint128 uint128_lit(const unsigned long long h, const unsigned long long l)
+{
+	return uint128{ h, l };
+}
+
+inline uint128 uint128_cidr(const unsigned char n)
+{
+	// ReSharper disable once CppInitializedValueIsAlwaysRewritten
+	uint128 rv{};
+	if (n <= 0) {
+		rv.h = 0;
+		rv.l = 0;
+	}
+	else if (n <= 64)
+	{
+		// ReSharper disable CppRedundantParentheses
+		rv.h = ~0ULL << (64 - n);
+		rv.l = 0;
+	}
+	else if (n <= 128)
+	{
+		rv.h = ~0ULL;
+		rv.l = ~0ULL << (128 - n);
+		// ReSharper restore CppRedundantParentheses
+	}
+	else
+	{
+		rv.h = ~0ULL;
+		rv.l = ~0ULL;
+	}
+	return rv;
+}
+
+inline int cidr(const uint128& u)
+{
+	int n{};
+	for (unsigned long long v{ u.l }; v > 0; v <<= 1)
+		n++;
+	for (unsigned long long v{ u.h }; v > 0; v <<= 1)
+		n++;
+	return n;
+}
+
+struct uint128_less
+{
+	bool operator()(const uint128& x, const uint128& y) const
+	{
+		return uint128_cmp(x, y) < 0;
+	}
+};
+
+struct tag_nm
+{
+	std::vector<uint128> keys;
+	std::vector<unsigned char> lengths;
+	std::vector<bool> families;
+	bool normalized;
+};
+
+inline int nm_domain(const tag_nm* self, const size_t i)
+{
+	return self->families[i] ? AF_INET6 : AF_INET;
+}
+
+inline void nm_push(const nm self, const uint128& net_address, const int length, const int domain)
+{
+	self->keys.push_back(net_address);
+	self->lengths.push_back(static_cast<unsigned char>(length));
+	self->families.push_back(domain != AF_INET);
+	self->normalized = false;
+}
+
+enum
+{
+	nm_parse_ok,
+	nm_parse_name,
+	nm_parse_mask,
+	nm_parse_overflow,
+};
+
+struct nm_spec
+{
+	uint128 low;
+	uint128 high;
+	int domain;
+	bool v6;
+};
+
+int is_v4(const uint128&, int, int);
+int nm_parse(std::string_view, nm_spec*);
+void nm_spec_push(nm, const nm_spec&);
+void nm_append(nm, const uint128&, int, bool);
+void nm_normalize(nm);
+void nm_range(nm, const uint128&, const uint128&, int);
+void nm_visit(const uint128&, int, int, void (*)(int, const nm_address*, nm_address*));
@@ -0,0 +1,188 @@
+#include <queue>
+#include <vector>
+#include "errors.h"
+#include "netmask_int.h"
+
+struct approx_node
+{
+	uint128 net_address;
+	uint128 covered;
+	uint128 extra;
+	size_t leaves;
+	size_t parent;
+	size_t left;
+	size_t right;
+	unsigned version;
+	unsigned char length;
+	bool collapsed;
+	bool dead;
+	int domain;
+};
+
+struct approx_candidate
+{
+	uint128 extra;
+	size_t node;
+	unsigned version;
+
+	bool operator<(const approx_candidate& o) const
+	{
+		const int cmp{ uint128_cmp(extra, o.extra) };
+		return cmp > 0 || (cmp == 0 && node > o.node);
+	}
+};
+
+constexpr size_t approx_none{ ~static_cast<size_t>(0) };
+
+static uint128 block_size(const int length)
+{
+	if (length == 0)
+		return uint128_lit(0, 0);
+	if (length <= 64)
+		return uint128_lit(1ULL << (64 - length), 0);
+	return uint128_lit(0, 1ULL << (128 - length));
+}
+
+static int common_length(const uint128& a, const uint128& b)
+{
+	const uint128 x{ uint128_xor(a, b) };
+	int n{};
+	for (unsigned long long v{ x.h }; n < 64 && !(v & 1ULL << 63); v <<= 1)
+		n++;
+	if (n == 64)
+		for (unsigned long long v{ x.l }; n < 128 && !(v & 1ULL << 63); v <<= 1)
+			n++;
+	return n;
+}
+
+static void approx_sum(std::vector<approx_node>& nodes, const size_t i)
+{
+	approx_node& node{ nodes[i] };
+	if (node.left == approx_none)
+		return;
+	approx_sum(nodes, node.left);
+	approx_sum(nodes, node.right);
+	node.covered = uint128_add(nodes[node.left].covered, nodes[node.right].covered, nullptr);
+	node.leaves = nodes[node.left].leaves + nodes[node.right].leaves;
+	node.extra = uint128_sub(block_size(node.length), node.covered, nullptr);
+	node.domain = nodes[node.left].domain == AF_INET ? nodes[node.right].domain : nodes[node.left].domain;
+}
+
+static void approx_kill(std::vector<approx_node>& nodes, const size_t i)
+{
+	std::vector<size_t> pending{ nodes[i].left, nodes[i].right };
+	while (!pending.empty())
+	{
+		approx_node& node{ nodes[pending.back()] };
+		pending.pop_back();
+		node.dead = true;
+		if (node.left != approx_none)
+		{
+			pending.push_back(node.left);
+			pending.push_back(node.right);
+		}
+	}
+}
+
+static void approx_emit(std::vector<approx_node>& nodes, const size_t root, const nm result)
+{
+	std::vector<size_t> pending{ root };
+	while (!pending.empty())
+	{
+		const approx_node& node{ nodes[pending.back()] };
+		pending.pop_back();
+		if (node.collapsed || node.left == approx_none)
+			nm_push(result, node.net_address, node.length, node.domain);
+		else
+		{
+			pending.push_back(node.right);
+			pending.push_back(node.left);
+		}
+	}
+}
+
+nm nm_approximate(const nm self, const size_t max, in6_addr* accepted)
+{
+	std::vector<approx_node> nodes;
+	std::vector<size_t> roots, stack;
+	int run{ -1 };
+	nm_normalize(self);
+	size_t count{ self ? self->keys.size() : 0 };
+	for (size_t i{}; i < count; i++)
+	{
+		const uint128 net_address{ self->keys[i] };
+		const unsigned char length{ self->lengths[i] };
+		const int v4{ is_v4(net_address, length, AF_INET) };
+		const size_t leaf{ nodes.size() };
+		nodes.push_back(approx_node{ net_address, block_size(length), {}, 1, approx_none, approx_none, approx_none, 0, length, false, false, nm_domain(self, i) });
+		if (v4 != run)
+		{
+			if (!stack.empty())
+				roots.push_back(stack.front());
+			stack.assign(1, leaf);
+			run = v4;
+			continue;
+		}
+		const int d{ common_length(nodes[stack.back()].net_address, net_address) };
+		size_t last{ approx_none };
+		while (!stack.empty() && nodes[stack.back()].length > d)
+		{
+			last = stack.back();
+			stack.pop_back();
+		}
+		const size_t inner{ nodes.size() };
+		nodes.push_back(approx_node{ uint128_and(net_address, uint128_cidr(static_cast<unsigned char>(d))), {}, {}, 0, approx_none, last, leaf, 0, static_cast<unsigned char>(d), false, false, AF_INET });
+		nodes[last].parent = inner;
+		nodes[leaf].parent = inner;
+		if (!stack.empty())
+		{
+			nodes[stack.back()].right = inner;
+			nodes[inner].parent = stack.back();
+		}
+		stack.push_back(inner);
+		stack.push_back(leaf);
+	}
+	if (!stack.empty())
+		roots.push_back(stack.front());
+	std::priority_queue<approx_candidate> queue;
+	for (const size_t root : roots)
+		approx_sum(nodes, root);
+	for (size_t i{}; i < nodes.size(); i++)
+		if (nodes[i].left != approx_none)
+			queue.push(approx_candidate{ nodes[i].extra, i, 0 });
+	uint128 total{};
+	while (!queue.empty() && (count > max || uint128_cmp(queue.top().extra, uint128_lit(0, 0)) == 0))
+	{
+		const approx_candidate top{ queue.top() };
+		queue.pop();
+		approx_node& node{ nodes[top.node] };
+		if (node.dead || node.collapsed || node.version != top.version)
+			continue;
+		const uint128 delta{ node.extra };
+		const size_t removed{ node.leaves - 1 };
+		status("collapse %016llx %016llx/%d adding %016llx %016llx", node.net_address.h, node.net_address.l, node.length, delta.h, delta.l);
+		total = uint128_add(total, delta, nullptr);
+		count -= removed;
+		node.collapsed = true;
+		node.covered = block_size(node.length);
+		node.extra = uint128_lit(0, 0);
+		node.leaves = 1;
+		approx_kill(nodes, top.node);
+		for (size_t i{ node.parent }; i != approx_none; i = nodes[i].parent)
+		{
+			approx_node& up{ nodes[i] };
+			up.covered = uint128_add(up.covered, delta, nullptr);
+			up.extra = uint128_sub(up.extra, delta, nullptr);
+			up.leaves -= removed;
+			queue.push(approx_candidate{ up.extra, i, ++up.version });
+		}
+	}
+	if (count > max)
+		warn("cannot reduce below %zu prefixes", count);
+	*accepted = s6_of_u128(total);
+	const nm result{ new tag_nm{} };
+	for (const size_t root : roots)
+		approx_emit(nodes, root, result);
+	nm_free(self);
+	return result;
+}
@@ -0,0 +1,149 @@
+#include "nmset.h"
+#include <map>
+#include "errors.h"
+#include "netmask_int.h"
+
+struct nm_entry
+{
+	unsigned char length;
+	int domain;
+};
+
+using nm_entries = std::map<uint128, nm_entry, uint128_less>;
+
+struct tag_nm_set
+{
+	nm_entries entries;
+};
+
+static uint128 uint128_bit(const int length)
+{
+	if (length <= 64)
+		return uint128_lit(1ULL << (64 - length), 0);
+	return uint128_lit(0, 1ULL << (128 - length));
+}
+
+static uint128 broadcast(const uint128& net_address, const int length)
+{
+	return uint128_or(net_address, uint128_neg(uint128_cidr(static_cast<unsigned char>(length))));
+}
+
+static int merge_domain(const int a, const int b)
+{
+	return a == AF_INET ? b : a;
+}
+
+static nm_entries::iterator covering(nm_entries& entries, const uint128& address)
+{
+	auto it{ entries.upper_bound(address) };
+	if (it == entries.begin())
+		return entries.end();
+	--it;
+	if (uint128_cmp(uint128_and(address, uint128_cidr(it->second.length)), it->first) != 0)
+		return entries.end();
+	return it;
+}
+
+static void add_one(nm_entries& entries, uint128 net_address, int length, int domain)
+{
+	auto it{ covering(entries, net_address) };
+	if (it != entries.end() && it->second.length <= length)
+	{
+		it->second.domain = merge_domain(domain, it->second.domain);
+		return;
+	}
+	const uint128 last{ broadcast(net_address, length) };
+	auto first{ entries.lower_bound(net_address) };
+	for (it = first; it != entries.end() && uint128_cmp(it->first, last) <= 0; ++it)
+	{
+		status("found %016llx %016llx/%d a subset of %016llx %016llx/%d", it->first.h, it->first.l, it->second.length, net_address.h, net_address.l, length);
+		domain = merge_domain(domain, it->second.domain);
+	}
+	it = entries.emplace_hint(entries.erase(first, it), net_address, nm_entry{ static_cast<unsigned char>(length), domain });
+	while (length > 0)
+	{
+		const auto sibling{ entries.find(uint128_xor(net_address, uint128_bit(length))) };
+		if (sibling == entries.end() || sibling->second.length != length)
+			break;
+		status("joinable %016llx %016llx/%d and %016llx %016llx/%d", net_address.h, net_address.l, length, sibling->first.h, sibling->first.l, length);
+		domain = merge_domain(domain, sibling->second.domain);
+		if (uint128_cmp(sibling->first, net_address) < 0)
+		{
+			entries.erase(it);
+			it = sibling;
+			net_address = sibling->first;
+		}
+		else
+			entries.erase(sibling);
+		length--;
+		it->second = nm_entry{ static_cast<unsigned char>(length), domain };
+	}
+}
+
+static void remove_one(nm_entries& entries, const uint128& net_address, const int length)
+{
+	auto it{ covering(entries, net_address) };
+	if (it != entries.end() && it->second.length <= length)
+	{
+		const nm_entry outer{ it->second };
+		it = entries.erase(it);
+		for (int l{ outer.length + 1 }; l <= length; l++)
+		{
+			const uint128 piece{ uint128_xor(uint128_and(net_address, uint128_cidr(static_cast<unsigned char>(l))), uint128_bit(l)) };
+			status("split %016llx %016llx/%d", piece.h, piece.l, l);
+			entries.emplace(piece, nm_entry{ static_cast<unsigned char>(l), outer.domain });
+		}
+		return;
+	}
+	const uint128 last{ broadcast(net_address, length) };
+	auto first{ entries.lower_bound(net_address) };
+	for (it = first; it != entries.end() && uint128_cmp(it->first, last) <= 0; ++it)
+		;
+	entries.erase(first, it);
+}
+
+nm_set nm_set_new(nm list)
+{
+	const nm_set self{ new tag_nm_set{} };
+	nm_set_add(self, list);
+	return self;
+}
+
+void nm_set_free(const nm_set self)
+{
+	delete self;
+}
+
+void nm_set_add(const nm_set self, const nm list)
+{
+	for (size_t i{}; list && i < list->keys.size(); i++)
+		add_one(self->entries, list->keys[i], list->lengths[i], nm_domain(list, i));
+	nm_free(list);
+}
+
+void nm_set_remove(const nm_set self, const nm list)
+{
+	for (size_t i{}; list && i < list->keys.size(); i++)
+		remove_one(self->entries, list->keys[i], list->lengths[i]);
+	nm_free(list);
+}
+
+int nm_set_lookup(const nm_set self, const nm address, void (*cb)(int, const nm_address*, nm_address*))
+{
+	const auto it{ covering(self->entries, address->keys[0]) };
+	if (it == self->entries.end())
+		return 0;
+	nm_visit(it->first, it->second.length, it->second.domain, cb);
+	return 1;
+}
+
+size_t nm_set_size(const nm_set self)
+{
+	return self->entries.size();
+}
+
+void nm_set_walk(const nm_set self, void (*cb)(int, const nm_address*, nm_address*))
+{
+	for (const auto& [net_address, entry] : self->entries)
+		nm_visit(net_address, entry.length, entry.domain, cb);
+}
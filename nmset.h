@@ -0,0 +1,12 @@
+#pragma once
+#include <cstddef>
+#include "netmask.h"
+
+using nm_set = struct tag_nm_set*;
+nm_set nm_set_new(nm);
+void nm_set_free(nm_set);
+void nm_set_add(nm_set, nm);
+void nm_set_remove(nm_set, nm);
+int nm_set_lookup(nm_set, nm, void (*)(int, const nm_address*, nm_address*));
+size_t nm_set_size(nm_set);
+void nm_set_walk(nm_set, void (*)(int, const nm_address*, nm_address*));
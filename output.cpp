@@ -0,0 +1,200 @@
+#include "output.h"
+#include <atomic>
+#include <condition_variable>
+#include <cstdarg>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <Windows.h>
+#include "errors.h"
+
+constexpr size_t out_threshold{ 1 << 16 };
+
+struct out_pool
+{
+	size_t chunks;
+	size_t slots;
+	void (*format)(size_t, size_t);
+	std::atomic<size_t> next;
+	size_t written;
+	std::vector<char> done;
+	std::mutex lock;
+	std::condition_variable changed;
+};
+
+static out_buffer out_stdout{ nullptr, 0, 0, stdout };
+static thread_local out_buffer* out_current{};
+
+static out_buffer* current()
+{
+	return out_current ? out_current : &out_stdout;
+}
+
+static void drain(out_buffer* b)
+{
+	if (b->fp && b->length)
+	{
+		if (fwrite(b->data, 1, b->length, b->fp) != b->length)
+			panic("failed to write output");
+		b->length = 0;
+	}
+}
+
+out_buffer* out_select(out_buffer* b)
+{
+	out_buffer* previous{ out_current };
+	out_current = b;
+	return previous;
+}
+
+char* out_reserve(const size_t n)
+{
+	out_buffer* b{ current() };
+	if (b->length + n > out_threshold)
+		drain(b);
+	if (b->length + n > b->capacity)
+	{
+		size_t capacity{ b->capacity ? b->capacity * 2 : out_threshold };
+		while (capacity < b->length + n)
+			capacity *= 2;
+		char* data{ static_cast<char*>(realloc(b->data, capacity)) };
+		if (!data)
+			panic("out of memory");
+		b->data = data;
+		b->capacity = capacity;
+	}
+	return b->data + b->length;
+}
+
+void out_commit(const char* end)
+{
+	out_buffer* b{ current() };
+	b->length = static_cast<size_t>(end - b->data);
+}
+
+void out_write(const char* data, const size_t n)
+{
+	if (out_buffer* b{ current() }; b->fp && n >= out_threshold)
+	{
+		drain(b);
+		if (fwrite(data, 1, n, b->fp) != n)
+			panic("failed to write output");
+		return;
+	}
+	char* p{ out_reserve(n) };
+	memcpy(p, data, n);
+	out_commit(p + n);
+}
+
+int out_printf(const char* fmt, ...)
+{
+	va_list args;
+	va_start(args, fmt);
+	const int n{ _vscprintf(fmt, args) };
+	va_end(args);
+	if (n < 0)
+		return n;
+	char* p{ out_reserve(static_cast<size_t>(n) + 1) };
+	va_start(args, fmt);
+	[[maybe_unused]] int result{ vsprintf_s(p, static_cast<size_t>(n) + 1, fmt, args) };
+	va_end(args);
+	out_commit(p + n);
+	return n;
+}
+
+void out_flush()
+{
+	out_buffer* b{ current() };
+	drain(b);
+	if (b->fp)
+		fflush(b->fp);
+}
+
+void out_release(out_buffer* b)
+{
+	free(b->data);
+	b->data = nullptr;
+	b->length = 0;
+	b->capacity = 0;
+}
+
+int out_open(out_buffer* b, const char* path)
+{
+	const std::string temporary{ std::string{ path } + ".tmp" };
+	b->length = 0;
+	if (fopen_s(&b->fp, temporary.c_str(), "wb") != 0 || !b->fp)
+	{
+		warn("failed to create \"%s\"", temporary.c_str());
+		return 0;
+	}
+	return 1;
+}
+
+int out_replace(out_buffer* b, const char* path)
+{
+	const std::string temporary{ std::string{ path } + ".tmp" };
+	drain(b);
+	const int closed{ fclose(b->fp) == 0 };
+	b->fp = nullptr;
+	out_release(b);
+	if (!closed || !MoveFileExA(temporary.c_str(), path, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH))
+	{
+		warn("failed to replace \"%s\"", path);
+		return 0;
+	}
+	return 1;
+}
+
+static void out_worker(out_pool* pool)
+{
+	for (size_t chunk{ pool->next++ }; chunk < pool->chunks; chunk = pool->next++)
+	{
+		{
+			std::unique_lock<std::mutex> hold{ pool->lock };
+			pool->changed.wait(hold, [&] { return chunk < pool->written + pool->slots; });
+		}
+		pool->format(chunk, chunk % pool->slots);
+		{
+			const std::lock_guard<std::mutex> hold{ pool->lock };
+			pool->done[chunk % pool->slots] = 1;
+		}
+		pool->changed.notify_all();
+	}
+}
+
+void out_parallel(const size_t chunks, const size_t threads, void (*format)(size_t chunk, size_t slot), void (*finish)(size_t slot))
+{
+	if (threads <= 1)
+	{
+		for (size_t chunk{}; chunk < chunks; chunk++)
+		{
+			format(chunk, 0);
+			finish(0);
+		}
+		return;
+	}
+	out_pool pool{ .chunks = chunks, .slots = 2 * threads, .format = format, .done = std::vector<char>(2 * threads) };
+	std::vector<std::thread> workers;
+	for (size_t t{}; t < threads; t++)
+		workers.emplace_back(out_worker, &pool);
+	for (size_t chunk{}; chunk < chunks; chunk++)
+	{
+		const size_t slot{ chunk % pool.slots };
+		{
+			std::unique_lock<std::mutex> hold{ pool.lock };
+			pool.changed.wait(hold, [&] { return pool.done[slot] != 0; });
+			pool.done[slot] = 0;
+		}
+		finish(slot);
+		{
+			const std::lock_guard<std::mutex> hold{ pool.lock };
+			pool.written++;
+		}
+		pool.changed.notify_all();
+	}
+	for (std::thread& w : workers)
+		w.join();
+}
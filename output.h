@@ -0,0 +1,22 @@
+#pragma once
+#include <cstddef>
+#include <cstdio>
+
+struct out_buffer
+{
+	char* data;
+	size_t length;
+	size_t capacity;
+	FILE* fp;
+};
+
+out_buffer* out_select(out_buffer*);
+char* out_reserve(size_t);
+void out_commit(const char*);
+void out_write(const char*, size_t);
+int out_printf(const char* fmt, ...);
+void out_flush();
+void out_release(out_buffer*);
+int out_open(out_buffer*, const char* path);
+int out_replace(out_buffer*, const char* path);
+void out_parallel(size_t chunks, size_t threads, void (*format)(size_t chunk, size_t slot), void (*finish)(size_t slot));
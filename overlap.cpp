@@ -0,0 +1,116 @@
+#include "overlap.h"
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "errors.h"
+#include "netmask_int.h"
+#include "output.h"
+
+struct overlap_input
+{
+	const char* source;
+	size_t line;
+	size_t spec;
+	size_t spans;
+	size_t covered;
+	const overlap_input* cover;
+	const overlap_input* overlap;
+};
+
+struct overlap_span
+{
+	uint128 low;
+	uint128 high;
+	size_t input;
+};
+
+struct tag_nm_overlap
+{
+	std::vector<overlap_input> inputs;
+	std::vector<overlap_span> spans;
+	std::string specs;
+};
+
+nm_overlap nm_overlap_new()
+{
+	return new tag_nm_overlap{};
+}
+
+void nm_overlap_add(const nm_overlap self, const nm n, const char* source, const size_t line, const char* spec)
+{
+	const uint128 one{ uint128_lit(0, 1) };
+	const size_t input{ self->inputs.size() };
+	self->inputs.push_back(overlap_input{ source, line, self->specs.size(), 0, 0, nullptr, nullptr });
+	self->specs.append(spec, strlen(spec) + 1);
+	nm_normalize(n);
+	for (size_t i{}; i < n->keys.size(); i++)
+	{
+		const uint128 low{ n->keys[i] };
+		const uint128 high{ uint128_or(low, uint128_neg(uint128_cidr(n->lengths[i]))) };
+		bool carry{};
+		if (i > 0 && uint128_cmp(uint128_add(self->spans.back().high, one, &carry), low) == 0 && !carry)
+			self->spans.back().high = high;
+		else
+		{
+			self->spans.push_back(overlap_span{ low, high, input });
+			self->inputs[input].spans++;
+		}
+	}
+	nm_free(n);
+}
+
+static void overlap_print(const nm_overlap self, const overlap_input& a, const char* relation, const overlap_input& b)
+{
+	out_printf("%s:%zu: %s %s %s:%zu: %s\n", a.source, a.line, self->specs.data() + a.spec, relation, b.source, b.line, self->specs.data() + b.spec);
+}
+
+void nm_overlap_report(const nm_overlap self)
+{
+	std::vector<overlap_span>& spans{ self->spans };
+	size_t covered{}, overlapping{};
+	std::sort(spans.begin(), spans.end(), [](const overlap_span& a, const overlap_span& b)
+	{
+		if (const int cmp{ uint128_cmp(a.low, b.low) })
+			return cmp < 0;
+		if (const int cmp{ uint128_cmp(a.high, b.high) })
+			return cmp > 0;
+		return a.input < b.input;
+	});
+	status("sweeping %zu spans from %zu inputs", spans.size(), self->inputs.size());
+	const overlap_span* reach{};
+	for (const overlap_span& s : spans)
+	{
+		overlap_input& input{ self->inputs[s.input] };
+		if (reach && reach->input != s.input && uint128_cmp(reach->high, s.high) >= 0)
+		{
+			if (!input.cover)
+				input.cover = &self->inputs[reach->input];
+			input.covered++;
+			continue;
+		}
+		if (reach && reach->input != s.input && uint128_cmp(reach->high, s.low) >= 0 && !input.overlap)
+			input.overlap = &self->inputs[reach->input];
+		if (!reach || uint128_cmp(s.high, reach->high) > 0)
+			reach = &s;
+	}
+	for (const overlap_input& input : self->inputs)
+	{
+		if (input.covered == input.spans && input.cover)
+		{
+			overlap_print(self, input, "covered by", *input.cover);
+			covered++;
+		}
+		else if (input.overlap || input.cover)
+		{
+			overlap_print(self, input, "overlaps", input.overlap ? *input.overlap : *input.cover);
+			overlapping++;
+		}
+	}
+	out_printf("%zu inputs, %zu covered, %zu overlapping\n", self->inputs.size(), covered, overlapping);
+}
+
+void nm_overlap_free(const nm_overlap self)
+{
+	delete self;
+}
@@ -0,0 +1,9 @@
+#pragma once
+#include <cstddef>
+#include "netmask.h"
+
+using nm_overlap = struct tag_nm_overlap*;
+nm_overlap nm_overlap_new();
+void nm_overlap_add(nm_overlap, nm, const char* source, size_t line, const char* spec);
+void nm_overlap_report(nm_overlap);
+void nm_overlap_free(nm_overlap);
@@ -0,0 +1,238 @@
+#include "radix.h"
+#include <algorithm>
+#include <array>
+#include <barrier>
+#include <cstring>
+#include <memory>
+#include <thread>
+#include <vector>
+
+constexpr size_t radix_min_items{ 256 };
+constexpr size_t radix_thread_items{ 1 << 16 };
+constexpr int radix_digits{ 17 };
+constexpr int radix_group{ radix_digits };
+constexpr int radix_packed_bits{ 55 };
+
+using radix_count = std::array<size_t, 256>;
+
+struct radix_mask
+{
+	uint128 all;
+	uint128 any;
+	unsigned char length_all;
+	unsigned char length_any;
+};
+
+struct radix_sort
+{
+	nm_sort_item* items;
+	nm_sort_item* scratch;
+	size_t count;
+	size_t threads;
+	std::vector<radix_count> hist;
+	std::vector<radix_mask> masks;
+	std::barrier<> sync;
+};
+
+static unsigned radix_digit(const nm_sort_item& item, const int digit)
+{
+	if (digit == radix_group)
+	{
+		const unsigned long long top{ item.key.l >> 32 };
+		return item.key.h || top > 0xffff ? 2 : top == 0xffff;
+	}
+	if (digit == 0)
+		return item.length;
+	return static_cast<unsigned>((digit <= 8 ? item.key.l >> 8 * (digit - 1) : item.key.h >> 8 * (digit - 9)) & 0xff);
+}
+
+static unsigned radix_byte(const unsigned long long v, const int digit)
+{
+	return static_cast<unsigned>(v >> 8 * digit & 0xff);
+}
+
+static bool radix_less(const nm_sort_item& a, const nm_sort_item& b)
+{
+	const int cmp{ uint128_cmp(a.key, b.key) };
+	return cmp < 0 || (cmp == 0 && a.length < b.length);
+}
+
+static unsigned long long radix_field(const uint128& v, const int shift)
+{
+	if (shift >= 64)
+		return v.h >> (shift - 64);
+	return shift ? v.l >> shift | v.h << (64 - shift) : v.l;
+}
+
+static uint128 radix_unfield(const unsigned long long v, const int shift)
+{
+	if (shift >= 64)
+		return uint128_lit(v << (shift - 64), 0);
+	return uint128_lit(shift ? v >> (64 - shift) : 0, v << shift);
+}
+
+template <typename T, typename Digit>
+static bool radix_pass(radix_sort* self, const size_t t, const T* src, T* dst, const size_t low, const size_t high, const Digit& digit, const int d, const radix_count* counted)
+{
+	const size_t n{ high - low };
+	const size_t begin{ low + n * t / self->threads }, end{ low + n * (t + 1) / self->threads };
+	radix_count& hist{ self->hist[t] };
+	if (counted)
+		hist = *counted;
+	else
+	{
+		hist.fill(0);
+		for (size_t i{ begin }; i < end; i++)
+			hist[digit(src[i], d)]++;
+	}
+	self->sync.arrive_and_wait();
+	radix_count next{};
+	size_t offset{ low };
+	bool constant{};
+	for (size_t b{}; b < 256; b++)
+	{
+		const size_t first{ offset };
+		for (size_t u{}; u < self->threads; u++)
+		{
+			if (u == t)
+				next[b] = offset;
+			offset += self->hist[u][b];
+		}
+		constant |= offset - first == n;
+	}
+	if (!constant)
+		for (size_t i{ begin }; i < end; i++)
+			dst[next[digit(src[i], d)]++] = src[i];
+	self->sync.arrive_and_wait();
+	return !constant;
+}
+
+template <typename T, typename Digit>
+static T* radix_passes(radix_sort* self, const size_t t, T* src, T* dst, const size_t low, const size_t high, const int* digits, const int count, const Digit& digit)
+{
+	std::vector<radix_count> counted;
+	if (self->threads == 1)
+	{
+		counted.resize(count);
+		for (size_t i{ low }; i < high; i++)
+			for (int j{}; j < count; j++)
+				counted[j][digit(src[i], digits[j])]++;
+	}
+	for (int j{}; j < count; j++)
+		if (radix_pass(self, t, src, dst, low, high, digit, digits[j], counted.empty() ? nullptr : &counted[j]))
+			std::swap(src, dst);
+	return src;
+}
+
+static void radix_packed(radix_sort* self, const size_t t, nm_sort_item* src, nm_sort_item* dst, const size_t low, const size_t high, const radix_mask& m)
+{
+	const uint128 differ{ uint128_xor(m.all, m.any) };
+	const int shift{ differ.h | differ.l ? uint128_ctz(differ) : 0 };
+	const unsigned long long varies{ radix_field(differ, shift) << 9 | static_cast<unsigned long long>(m.length_all ^ m.length_any) << 1 };
+	const size_t n{ high - low };
+	const size_t begin{ n * t / self->threads }, end{ n * (t + 1) / self->threads };
+	const auto packed{ reinterpret_cast<unsigned long long*>(dst + low) };
+	for (size_t i{ begin }; i < end; i++)
+	{
+		const nm_sort_item& item{ src[low + i] };
+		packed[i] = radix_field(item.key, shift) << 9 | static_cast<unsigned long long>(item.length) << 1 | item.v6;
+	}
+	int digits[8]{}, count{};
+	for (int digit{}; digit < 8; digit++)
+		if (radix_byte(varies, digit))
+			digits[count++] = digit;
+	self->sync.arrive_and_wait();
+	const unsigned long long* sorted{ radix_passes(self, t, packed, packed + n, 0, n, digits, count, radix_byte) };
+	const uint128 fixed{ uint128_and(m.all, uint128_neg(radix_unfield(~0ULL >> 9, shift))) };
+	for (size_t i{ begin }; i < end; i++)
+	{
+		const unsigned long long v{ sorted[i] };
+		src[low + i] = nm_sort_item{ uint128_or(fixed, radix_unfield(v >> 9, shift)), static_cast<unsigned char>(v >> 1), static_cast<bool>(v & 1) };
+	}
+	self->sync.arrive_and_wait();
+	if (src != self->items)
+		memcpy(self->items + low + begin, src + low + begin, (end - begin) * sizeof(nm_sort_item));
+}
+
+static void radix_wide(radix_sort* self, const size_t t, nm_sort_item* src, nm_sort_item* dst, const size_t low, const size_t high, const radix_mask& m)
+{
+	const uint128 differ{ uint128_xor(m.all, m.any) };
+	int digits[radix_digits]{}, count{};
+	if (m.length_all != m.length_any)
+		digits[count++] = 0;
+	for (int digit{ 1 }; digit < radix_digits; digit++)
+		if ((digit <= 8 ? differ.l >> 8 * (digit - 1) : differ.h >> 8 * (digit - 9)) & 0xff)
+			digits[count++] = digit;
+	const nm_sort_item* sorted{ radix_passes(self, t, src, dst, low, high, digits, count, radix_digit) };
+	const size_t n{ high - low };
+	const size_t begin{ low + n * t / self->threads }, end{ low + n * (t + 1) / self->threads };
+	if (sorted != self->items)
+		memcpy(self->items + begin, sorted + begin, (end - begin) * sizeof(nm_sort_item));
+}
+
+static void radix_range(radix_sort* self, const size_t t, nm_sort_item* src, nm_sort_item* dst, const size_t low, const size_t high)
+{
+	const size_t n{ high - low };
+	radix_mask m{ uint128_lit(~0ULL, ~0ULL), uint128_lit(0, 0), 0xff, 0 };
+	for (size_t i{ low + n * t / self->threads }, end{ low + n * (t + 1) / self->threads }; i < end; i++)
+	{
+		m.all = uint128_and(m.all, src[i].key);
+		m.any = uint128_or(m.any, src[i].key);
+		m.length_all &= src[i].length;
+		m.length_any |= src[i].length;
+	}
+	self->masks[t] = m;
+	self->sync.arrive_and_wait();
+	for (size_t u{}; u < self->threads; u++)
+	{
+		m.all = uint128_and(m.all, self->masks[u].all);
+		m.any = uint128_or(m.any, self->masks[u].any);
+		m.length_all &= self->masks[u].length_all;
+		m.length_any |= self->masks[u].length_any;
+	}
+	self->sync.arrive_and_wait();
+	const uint128 differ{ uint128_xor(m.all, m.any) };
+	if (uint128_width(differ) - (differ.h | differ.l ? uint128_ctz(differ) : 0) <= radix_packed_bits)
+		radix_packed(self, t, src, dst, low, high, m);
+	else
+		radix_wide(self, t, src, dst, low, high, m);
+}
+
+static void radix_worker(radix_sort* self, const size_t t)
+{
+	nm_sort_item* src{ self->items };
+	nm_sort_item* dst{ self->scratch };
+	if (radix_pass(self, t, src, dst, 0, self->count, radix_digit, radix_group, nullptr))
+		std::swap(src, dst);
+	size_t groups[3]{};
+	for (size_t u{}; u < self->threads; u++)
+		for (size_t g{}; g < 3; g++)
+			groups[g] += self->hist[u][g];
+	size_t low{};
+	for (const size_t n : groups)
+	{
+		if (n)
+			radix_range(self, t, src, dst, low, low + n);
+		low += n;
+	}
+}
+
+void nm_radix_sort(nm_sort_item* items, const size_t count, unsigned threads)
+{
+	if (count < radix_min_items)
+	{
+		std::sort(items, items + count, radix_less);
+		return;
+	}
+	if (!threads)
+		threads = std::thread::hardware_concurrency();
+	threads = static_cast<unsigned>(std::clamp<size_t>(count / radix_thread_items, 1, std::max(threads, 1U)));
+	const std::unique_ptr<nm_sort_item[]> scratch{ new nm_sort_item[count] };
+	radix_sort self{ .items = items, .scratch = scratch.get(), .count = count, .threads = threads, .hist = std::vector<radix_count>(threads), .masks = std::vector<radix_mask>(threads), .sync = std::barrier<>(threads) };
+	std::vector<std::thread> workers;
+	for (size_t t{ 1 }; t < threads; t++)
+		workers.emplace_back(radix_worker, &self, t);
+	radix_worker(&self, 0);
+	for (std::thread& w : workers)
+		w.join();
+}
@@ -0,0 +1,12 @@
+#pragma once
+#include <cstddef>
+#include "netmask_int.h"
+
+struct nm_sort_item
+{
+	uint128 key;
+	unsigned char length;
+	bool v6;
+};
+
+void nm_radix_sort(nm_sort_item*, size_t count, unsigned threads);
@@ -0,0 +1,154 @@
+#include "sample.h"
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <unordered_set>
+#include <vector>
+#include "errors.h"
+#include "netmask_int.h"
+#include "output.h"
+
+struct sample_random
+{
+	unsigned long long s[4];
+};
+
+struct sample_hash
+{
+	size_t operator()(const uint128& v) const
+	{
+		return std::hash<unsigned long long>{}(v.h * 0x9e3779b97f4a7c15ULL ^ v.l);
+	}
+};
+
+struct sample_equal
+{
+	bool operator()(const uint128& x, const uint128& y) const
+	{
+		return uint128_cmp(x, y) == 0;
+	}
+};
+
+static unsigned long long splitmix64(unsigned long long* state)
+{
+	unsigned long long z{ *state += 0x9e3779b97f4a7c15ULL };
+	z = (z ^ z >> 30) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ z >> 27) * 0x94d049bb133111ebULL;
+	return z ^ z >> 31;
+}
+
+static unsigned long long random_next(sample_random* r)
+{
+	unsigned long long* s{ r->s };
+	const unsigned long long result{ std::rotl(s[1] * 5, 7) * 9 };
+	const unsigned long long t{ s[1] << 17 };
+	s[2] ^= s[0];
+	s[3] ^= s[1];
+	s[1] ^= s[2];
+	s[0] ^= s[3];
+	s[2] ^= t;
+	s[3] = std::rotl(s[3], 45);
+	return result;
+}
+
+static uint128 random_below(sample_random* r, const uint128& bound)
+{
+	const uint128 last{ uint128_sub(bound, uint128_lit(0, 1), nullptr) };
+	const int width{ uint128_width(last) };
+	const uint128 mask{ uint128_neg(uint128_cidr(static_cast<unsigned char>(128 - width))) };
+	for (;;)
+	{
+		const uint128 v{ uint128_and(uint128_lit(width > 64 ? random_next(r) : 0, random_next(r)), mask) };
+		if (uint128_cmp(v, bound) < 0)
+			return v;
+	}
+}
+
+static uint128 random_offset(sample_random* r, const uint128& total, const bool whole)
+{
+	return whole ? uint128_lit(random_next(r), random_next(r)) : random_below(r, total);
+}
+
+static char* format_v4(char* p, const unsigned v)
+{
+	for (int shift{ 24 }; shift >= 0; shift -= 8)
+	{
+		const unsigned o{ v >> shift & 0xff };
+		if (o >= 100)
+			*p++ = static_cast<char>('0' + o / 100);
+		if (o >= 10)
+			*p++ = static_cast<char>('0' + o / 10 % 10);
+		*p++ = static_cast<char>('0' + o % 10);
+		*p++ = shift ? '.' : '\n';
+	}
+	return p;
+}
+
+static void sample_write(const tag_nm* self, const std::vector<uint128>& ends, const uint128& offset)
+{
+	const size_t i{ static_cast<size_t>(std::upper_bound(ends.begin(), ends.end() - 1, offset, uint128_less{}) - ends.begin()) };
+	const uint128 base{ i ? ends[i - 1] : uint128_lit(0, 0) };
+	const uint128 address{ uint128_add(self->keys[i], uint128_sub(offset, base, nullptr), nullptr) };
+	char* p{ out_reserve(INET6_ADDRSTRLEN + 1) };
+	if (is_v4(self->keys[i], self->lengths[i], nm_domain(self, i)))
+		p = format_v4(p, static_cast<unsigned>(address.l));
+	else
+	{
+		const in6_addr s6{ s6_of_u128(address) };
+		inet_ntop(AF_INET6, &s6, p, INET6_ADDRSTRLEN);
+		p += strlen(p);
+		*p++ = '\n';
+	}
+	out_commit(p);
+}
+
+int nm_sample(const nm self, const nm_sampling* options)
+{
+	if (!nm_size(self))
+	{
+		warn("cannot draw addresses from an empty set");
+		return 0;
+	}
+	const bool whole{ self->lengths[0] == 0 };
+	std::vector<uint128> ends(self->keys.size());
+	uint128 total{};
+	for (size_t i{}; i < self->keys.size(); i++)
+	{
+		const uint128 size{ uint128_add(uint128_neg(uint128_cidr(self->lengths[i])), uint128_lit(0, 1), nullptr) };
+		ends[i] = total = uint128_add(total, size, nullptr);
+	}
+	status("sampling %llu addresses from %016llx %016llx", options->count, total.h, total.l);
+	sample_random r{};
+	unsigned long long seed{ options->seed };
+	for (unsigned long long& s : r.s)
+		s = splitmix64(&seed);
+	if (!options->unique)
+	{
+		for (unsigned long long n{}; n < options->count; n++)
+			sample_write(self, ends, random_offset(&r, total, whole));
+		return 1;
+	}
+	if (!whole && !total.h && total.l < options->count)
+	{
+		warn("cannot draw %llu distinct addresses from a set of %llu", options->count, total.l);
+		return 0;
+	}
+	if (whole || total.h || total.l / 2 >= options->count)
+	{
+		std::unordered_set<uint128, sample_hash, sample_equal> drawn;
+		drawn.reserve(static_cast<size_t>(options->count));
+		while (drawn.size() < options->count)
+			if (const uint128 offset{ random_offset(&r, total, whole) }; drawn.insert(offset).second)
+				sample_write(self, ends, offset);
+		return 1;
+	}
+	std::vector<unsigned long long> offsets(static_cast<size_t>(total.l));
+	for (size_t i{}; i < offsets.size(); i++)
+		offsets[i] = i;
+	for (size_t n{}; n < options->count; n++)
+	{
+		std::swap(offsets[n], offsets[n + static_cast<size_t>(random_below(&r, uint128_lit(0, total.l - n)).l)]);
+		sample_write(self, ends, uint128_lit(0, offsets[n]));
+	}
+	return 1;
+}
@@ -0,0 +1,11 @@
+#pragma once
+#include "netmask.h"
+
+struct nm_sampling
+{
+	unsigned long long count;
+	unsigned long long seed;
+	bool unique;
+};
+
+int nm_sample(nm, const nm_sampling*);
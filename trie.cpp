@@ -0,0 +1,140 @@
+#include "trie.h"
+#include <atomic>
+#include <vector>
+#include "netmask_int.h"
+
+constexpr unsigned char trie_covered{ 1 };
+constexpr unsigned char trie_v6{ 2 };
+
+struct trie_node
+{
+	std::atomic<trie_node*> child[2];
+	std::atomic<unsigned char> flags;
+};
+
+struct tag_nm_trie
+{
+	trie_node root;
+};
+
+static int trie_bit(const uint128& key, const int depth)
+{
+	return static_cast<int>(depth < 64 ? key.h >> (63 - depth) & 1 : key.l >> (127 - depth) & 1);
+}
+
+static size_t trie_insert(tag_nm_trie* self, const uint128& key, const int length, const bool v6)
+{
+	size_t contended{};
+	trie_node* node{ &self->root };
+	for (int depth{};; depth++)
+	{
+		if (depth == length)
+		{
+			node->flags.fetch_or(trie_covered | (v6 ? trie_v6 : 0), std::memory_order_release);
+			return contended;
+		}
+		if (node->flags.load(std::memory_order_acquire) & trie_covered)
+		{
+			if (v6)
+				node->flags.fetch_or(trie_v6, std::memory_order_release);
+			return contended;
+		}
+		std::atomic<trie_node*>& slot{ node->child[trie_bit(key, depth)] };
+		trie_node* next{ slot.load(std::memory_order_acquire) };
+		if (!next)
+		{
+			const auto fresh{ new trie_node{} };
+			if (slot.compare_exchange_strong(next, fresh, std::memory_order_acq_rel, std::memory_order_acquire))
+				next = fresh;
+			else
+			{
+				delete fresh;
+				contended++;
+			}
+		}
+		node = next;
+	}
+}
+
+nm_trie nm_trie_new()
+{
+	return new tag_nm_trie{};
+}
+
+size_t nm_trie_insert(const nm_trie self, const nm n)
+{
+	size_t contended{};
+	for (size_t i{}; n && i < n->keys.size(); i++)
+		contended += trie_insert(self, n->keys[i], n->lengths[i], n->families[i]);
+	return contended;
+}
+
+int nm_trie_contains(const nm_trie self, const in6_addr* s6)
+{
+	const uint128 key{ uint128_of_s6(s6) };
+	const trie_node* node{ &self->root };
+	for (int depth{}; node; depth++)
+	{
+		if (node->flags.load(std::memory_order_acquire) & trie_covered)
+			return 1;
+		if (depth == 128)
+			break;
+		node = node->child[trie_bit(key, depth)].load(std::memory_order_acquire);
+	}
+	return 0;
+}
+
+nm nm_trie_snapshot(const nm_trie self)
+{
+	struct frame
+	{
+		const trie_node* node;
+		uint128 key;
+		int depth;
+	};
+	const nm result{ new tag_nm{} };
+	std::vector<frame> stack{ frame{ &self->root, uint128{}, 0 } };
+	while (!stack.empty())
+	{
+		const frame f{ stack.back() };
+		stack.pop_back();
+		const unsigned char flags{ f.node->flags.load(std::memory_order_acquire) };
+		if (flags & trie_covered)
+			nm_push(result, f.key, f.depth, flags & trie_v6 ? AF_INET6 : AF_INET);
+		for (int bit{ 1 }; bit >= 0; bit--)
+		{
+			const trie_node* child{ f.node->child[bit].load(std::memory_order_acquire) };
+			if (!child)
+				continue;
+			uint128 key{ f.key };
+			if (bit)
+				key = uint128_or(key, f.depth < 64 ? uint128_lit(1ULL << (63 - f.depth), 0) : uint128_lit(0, 1ULL << (127 - f.depth)));
+			stack.push_back(frame{ child, key, f.depth + 1 });
+		}
+	}
+	if (result->keys.empty())
+	{
+		nm_free(result);
+		return nullptr;
+	}
+	nm_normalize(result);
+	return result;
+}
+
+void nm_trie_free(const nm_trie self)
+{
+	std::vector<trie_node*> stack;
+	for (const auto& c : self->root.child)
+		if (trie_node* child{ c.load() })
+			stack.push_back(child);
+	while (!stack.empty())
+	{
+		trie_node* node{ stack.back() };
+		stack.pop_back();
+		for (const auto& c : node->child)
+			if (trie_node* child{ c.load() })
+				stack.push_back(child);
+		delete node;
+	}
+	delete self;
+}
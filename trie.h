@@ -0,0 +1,10 @@
+#pragma once
+#include <cstddef>
+#include "netmask.h"
+
+using nm_trie = struct tag_nm_trie*;
+nm_trie nm_trie_new();
+size_t nm_trie_insert(nm_trie, nm);
+int nm_trie_contains(nm_trie, const in6_addr*);
+nm nm_trie_snapshot(nm_trie);
+void nm_trie_free(nm_trie);
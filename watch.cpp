@@ -0,0 +1,356 @@
+#include "watch.h"
+#include <algorithm>
+#include <cstring>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+#include <Windows.h>
+#include "errors.h"
+#include "input.h"
+#include "netmask_int.h"
+#include "output.h"
+
+constexpr DWORD watch_filter{ FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_LAST_WRITE | FILE_NOTIFY_CHANGE_SIZE };
+constexpr DWORD watch_settle{ 100 };
+
+struct watch_span
+{
+	uint128 low;
+	uint128 high;
+
+	bool operator==(const watch_span& o) const
+	{
+		return uint128_cmp(low, o.low) == 0 && uint128_cmp(high, o.high) == 0;
+	}
+};
+
+struct watch_file
+{
+	std::string directory;
+	std::string name;
+	std::vector<watch_span> all;
+	std::vector<watch_span> v6;
+	size_t inputs;
+	bool dirty;
+};
+
+struct watch_directory
+{
+	std::string path;
+	HANDLE handle;
+	OVERLAPPED overlapped;
+	DWORD buffer[16384];
+};
+
+using watch_counts = std::map<uint128, long long, uint128_less>;
+
+struct watch_cover
+{
+	std::vector<watch_span> all;
+	std::vector<watch_span> v6;
+	std::vector<size_t> first;
+	nm result;
+};
+
+static int watch_load(const char* path, const int flags, nm* result, size_t* inputs)
+{
+	char buf[1024]{};
+	nm self{};
+	*result = nullptr;
+	*inputs = 0;
+	const nm_input in{ input_open(path) };
+	if (!in)
+	{
+		warn("failed to open \"%s\", treating it as empty", path);
+		return 0;
+	}
+	while (input_token(in, buf, sizeof buf))
+	{
+		if (const nm n{ nm_new_str(buf, flags) })
+		{
+			self = nm_merge(self, n);
+			++*inputs;
+		}
+		else
+			warn("parse error \"%s\"", buf);
+	}
+	if (input_close(in))
+	{
+		nm_free(self);
+		return -1;
+	}
+	*result = self;
+	return 0;
+}
+
+static void watch_append(std::vector<watch_span>& spans, const uint128& low, const uint128& high)
+{
+	bool carry{};
+	if (!spans.empty() && uint128_cmp(uint128_add(spans.back().high, uint128_lit(0, 1), &carry), low) == 0 && !carry)
+		spans.back().high = high;
+	else
+		spans.push_back(watch_span{ low, high });
+}
+
+static void watch_spans(const nm self, std::vector<watch_span>& all, std::vector<watch_span>& v6)
+{
+	all.clear();
+	v6.clear();
+	nm_normalize(self);
+	for (size_t i{}; self && i < self->keys.size(); i++)
+	{
+		const uint128 high{ uint128_or(self->keys[i], uint128_neg(uint128_cidr(self->lengths[i]))) };
+		watch_append(all, self->keys[i], high);
+		if (self->families[i])
+			watch_append(v6, self->keys[i], high);
+	}
+	nm_free(self);
+}
+
+static void watch_bump(watch_counts& counts, const uint128& key, const long long delta)
+{
+	const auto it{ counts.emplace(key, 0).first };
+	it->second += delta;
+	if (!it->second)
+		counts.erase(it);
+}
+
+static size_t watch_update(watch_counts& counts, const std::vector<watch_span>& from, const std::vector<watch_span>& to)
+{
+	size_t changed{}, i{}, j{};
+	const auto apply{ [&](const watch_span& s, const long long delta)
+	{
+		bool carry{};
+		const uint128 next{ uint128_add(s.high, uint128_lit(0, 1), &carry) };
+		watch_bump(counts, s.low, delta);
+		if (!carry)
+			watch_bump(counts, next, -delta);
+		changed++;
+	} };
+	while (i < from.size() || j < to.size())
+	{
+		if (i < from.size() && j < to.size() && from[i] == to[j])
+		{
+			i++;
+			j++;
+		}
+		else if (j == to.size() || (i < from.size() && uint128_cmp(from[i].low, to[j].low) <= 0))
+			apply(from[i++], -1);
+		else
+			apply(to[j++], 1);
+	}
+	return changed;
+}
+
+static void watch_covered(const watch_counts& counts, std::vector<watch_span>& spans)
+{
+	long long depth{};
+	uint128 low{};
+	for (const auto& [key, delta] : counts)
+	{
+		const long long previous{ depth };
+		depth += delta;
+		if (!previous && depth)
+			low = key;
+		else if (previous && !depth)
+			spans.push_back(watch_span{ low, uint128_sub(key, uint128_lit(0, 1), nullptr) });
+	}
+	if (depth)
+		spans.push_back(watch_span{ low, uint128_lit(~0ULL, ~0ULL) });
+}
+
+static std::vector<watch_span> watch_touched(const std::vector<watch_span>& from, const std::vector<watch_span>& to)
+{
+	std::vector<watch_span> touched;
+	size_t i{}, j{};
+	while (i < from.size() || j < to.size())
+	{
+		if (i < from.size() && j < to.size() && from[i] == to[j])
+		{
+			i++;
+			j++;
+			continue;
+		}
+		const watch_span& s{ j == to.size() || (i < from.size() && uint128_cmp(from[i].low, to[j].low) <= 0) ? from[i++] : to[j++] };
+		if (!touched.empty() && uint128_cmp(s.low, touched.back().high) <= 0)
+			touched.back().high = uint128_cmp(s.high, touched.back().high) > 0 ? s.high : touched.back().high;
+		else
+			touched.push_back(s);
+	}
+	return touched;
+}
+
+static void watch_families(const nm self, const size_t first, const std::vector<watch_span>& v6)
+{
+	if (first == self->keys.size())
+		return;
+	size_t j{ static_cast<size_t>(std::partition_point(v6.begin(), v6.end(), [&](const watch_span& s) { return uint128_cmp(s.high, self->keys[first]) < 0; }) - v6.begin()) };
+	for (size_t i{ first }; i < self->keys.size(); i++)
+	{
+		const uint128 high{ uint128_or(self->keys[i], uint128_neg(uint128_cidr(self->lengths[i]))) };
+		while (j < v6.size() && uint128_cmp(v6[j].high, self->keys[i]) < 0)
+			j++;
+		self->families[i] = j < v6.size() && uint128_cmp(v6[j].low, high) <= 0;
+	}
+}
+
+static size_t watch_refresh(watch_cover& cover, const watch_counts& counts, const watch_counts& v6_counts)
+{
+	std::vector<watch_span> all, v6;
+	std::vector<size_t> first;
+	watch_covered(counts, all);
+	watch_covered(v6_counts, v6);
+	const std::vector<watch_span> touched{ watch_touched(cover.v6, v6) };
+	const nm old{ cover.result };
+	const nm self{ new tag_nm{} };
+	size_t i{}, k{}, derived{};
+	first.reserve(all.size());
+	for (const watch_span& s : all)
+	{
+		first.push_back(self->keys.size());
+		while (i < cover.all.size() && uint128_cmp(cover.all[i].low, s.low) < 0)
+			i++;
+		while (k < touched.size() && uint128_cmp(touched[k].high, s.low) < 0)
+			k++;
+		if (i < cover.all.size() && cover.all[i] == s)
+		{
+			const auto from{ static_cast<std::ptrdiff_t>(cover.first[i]) };
+			const auto to{ static_cast<std::ptrdiff_t>(i + 1 < cover.first.size() ? cover.first[i + 1] : old->keys.size()) };
+			self->keys.insert(self->keys.end(), old->keys.begin() + from, old->keys.begin() + to);
+			self->lengths.insert(self->lengths.end(), old->lengths.begin() + from, old->lengths.begin() + to);
+			self->families.insert(self->families.end(), old->families.begin() + from, old->families.begin() + to);
+			if (k == touched.size() || uint128_cmp(touched[k].low, s.high) > 0)
+				continue;
+		}
+		else
+		{
+			nm_range(self, s.low, s.high, AF_INET);
+			derived++;
+		}
+		watch_families(self, first.back(), v6);
+	}
+	self->normalized = true;
+	nm_free(old);
+	cover = watch_cover{ std::move(all), std::move(v6), std::move(first), self };
+	return derived;
+}
+
+static void watch_write(const watch_cover& cover, const size_t inputs, const char* output, void (*emit)(nm, size_t))
+{
+	out_buffer file{};
+	if (!out_open(&file, output))
+		return;
+	out_buffer* previous{ out_select(&file) };
+	emit(cover.result, inputs);
+	out_select(previous);
+	if (out_replace(&file, output))
+		status("wrote %zu prefixes to %s", cover.result->keys.size(), output);
+}
+
+static void watch_arm(watch_directory& d)
+{
+	if (!ReadDirectoryChangesW(d.handle, d.buffer, sizeof d.buffer, FALSE, watch_filter, nullptr, &d.overlapped, nullptr))
+		panic("failed to watch \"%s\"", d.path.c_str());
+}
+
+int nm_watch(const char* const* paths, const size_t count, const char* output, const int flags, void (*emit)(nm, size_t))
+{
+	std::vector<watch_file> files(count);
+	std::vector<watch_directory*> directories;
+	std::vector<HANDLE> events;
+	watch_counts counts, v6_counts;
+	watch_cover cover{ .result = new tag_nm{} };
+	for (size_t i{}; i < count; i++)
+	{
+		const char* base{ strrchr(paths[i], '\\') };
+		if (const char* slash{ strrchr(paths[i], '/') }; !base || (slash && slash > base))
+			base = slash;
+		watch_file& f{ files[i] };
+		f.directory = base ? std::string{ paths[i], static_cast<size_t>(base - paths[i]) + 1 } : std::string{ "." };
+		f.name = base ? base + 1 : paths[i];
+		nm loaded{};
+		if (watch_load(paths[i], flags, &loaded, &f.inputs) < 0)
+			panic("failed to load \"%s\"", paths[i]);
+		watch_spans(loaded, f.all, f.v6);
+		watch_update(counts, {}, f.all);
+		watch_update(v6_counts, {}, f.v6);
+		bool known{};
+		for (const watch_directory* d : directories)
+			known |= d->path == f.directory;
+		if (known)
+			continue;
+		const auto d{ new watch_directory{ f.directory } };
+		d->handle = CreateFileA(d->path.c_str(), FILE_LIST_DIRECTORY, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED, nullptr);
+		if (d->handle == INVALID_HANDLE_VALUE)
+			panic("failed to open directory \"%s\"", d->path.c_str());
+		d->overlapped.hEvent = CreateEventA(nullptr, TRUE, FALSE, nullptr);
+		watch_arm(*d);
+		directories.push_back(d);
+		events.push_back(d->overlapped.hEvent);
+	}
+	const auto total{ [&]
+	{
+		size_t inputs{};
+		for (const watch_file& f : files)
+			inputs += f.inputs;
+		return inputs;
+	} };
+	watch_refresh(cover, counts, v6_counts);
+	watch_write(cover, total(), output, emit);
+	for (;;)
+	{
+		const DWORD signaled{ WaitForMultipleObjects(static_cast<DWORD>(events.size()), events.data(), FALSE, INFINITE) };
+		if (signaled >= WAIT_OBJECT_0 + events.size())
+			panic("failed to wait for changes");
+		watch_directory& d{ *directories[signaled - WAIT_OBJECT_0] };
+		DWORD bytes{};
+		const BOOL ok{ GetOverlappedResult(d.handle, &d.overlapped, &bytes, FALSE) };
+		for (const char* p{ reinterpret_cast<const char*>(d.buffer) }; ok && bytes;)
+		{
+			const auto info{ reinterpret_cast<const FILE_NOTIFY_INFORMATION*>(p) };
+			char name[MAX_PATH * 4]{};
+			const int length{ WideCharToMultiByte(CP_UTF8, 0, info->FileName, static_cast<int>(info->FileNameLength / sizeof(WCHAR)), name, sizeof name - 1, nullptr, nullptr) };
+			name[length > 0 ? length : 0] = '\0';
+			for (watch_file& f : files)
+				if (f.directory == d.path && _stricmp(f.name.c_str(), name) == 0)
+					f.dirty = true;
+			if (!info->NextEntryOffset)
+				break;
+			p += info->NextEntryOffset;
+		}
+		if (!ok || !bytes)
+			for (watch_file& f : files)
+				f.dirty |= f.directory == d.path;
+		ResetEvent(d.overlapped.hEvent);
+		watch_arm(d);
+		Sleep(watch_settle);
+		size_t changed{};
+		for (size_t i{}; i < count; i++)
+		{
+			watch_file& f{ files[i] };
+			if (!f.dirty)
+				continue;
+			std::vector<watch_span> all, v6;
+			const size_t inputs{ f.inputs };
+			f.dirty = false;
+			nm loaded{};
+			if (watch_load(paths[i], flags, &loaded, &f.inputs) < 0)
+			{
+				f.inputs = inputs;
+				warn("keeping the previous contents of \"%s\"", paths[i]);
+				continue;
+			}
+			watch_spans(loaded, all, v6);
+			const size_t n{ watch_update(counts, f.all, all) + watch_update(v6_counts, f.v6, v6) };
+			status("reloaded %s with %zu changed spans", paths[i], n);
+			changed += n + (inputs != f.inputs);
+			f.all.swap(all);
+			f.v6.swap(v6);
+		}
+		if (!changed)
+			continue;
+		status("re-derived %zu spans", watch_refresh(cover, counts, v6_counts));
+		watch_write(cover, total(), output, emit);
+	}
+}
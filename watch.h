@@ -0,0 +1,5 @@
+#pragma once
+#include <cstddef>
+#include "netmask.h"
+
+int nm_watch(const char* const* paths, size_t count, const char* output, int flags, void (*)(nm, size_t));
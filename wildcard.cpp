@@ -0,0 +1,62 @@
+#include "wildcard.h"
+#include <algorithm>
+#include <vector>
+
+static bool wildcard_less(const nm_wildcard& a, const nm_wildcard& b)
+{
+	return a.mask < b.mask || (a.mask == b.mask && a.address < b.address);
+}
+
+static bool wildcard_pass(std::vector<nm_wildcard>& cubes, std::vector<nm_wildcard>& next)
+{
+	bool merged{};
+	std::sort(cubes.begin(), cubes.end(), wildcard_less);
+	std::vector<char> used(cubes.size());
+	next.clear();
+	for (size_t first{}, last{}; first < cubes.size(); first = last)
+	{
+		const unsigned mask{ cubes[first].mask };
+		for (last = first; last < cubes.size() && cubes[last].mask == mask; last++)
+			;
+		for (int bit{}; bit < 32; bit++)
+		{
+			const unsigned b{ 1U << bit };
+			if (mask & b)
+				continue;
+			for (size_t i{ first }, j{ first }; i < last; i++)
+			{
+				if (used[i] || cubes[i].address & b)
+					continue;
+				while (j < last && cubes[j].address < (cubes[i].address | b))
+					j++;
+				if (j == last)
+					break;
+				if (cubes[j].address == (cubes[i].address | b) && !used[j])
+				{
+					used[i] = used[j] = 1;
+					next.push_back(nm_wildcard{ cubes[i].address, mask | b });
+					merged = true;
+				}
+			}
+		}
+		for (size_t i{ first }; i < last; i++)
+			if (!used[i])
+				next.push_back(cubes[i]);
+	}
+	cubes.swap(next);
+	return merged;
+}
+
+size_t nm_wildcard_merge(nm_wildcard* cubes, const size_t count)
+{
+	std::vector<nm_wildcard> current(cubes, cubes + count), next;
+	next.reserve(count);
+	while (wildcard_pass(current, next))
+		;
+	std::sort(current.begin(), current.end(), [](const nm_wildcard& a, const nm_wildcard& b)
+	{
+		return a.address < b.address || (a.address == b.address && a.mask < b.mask);
+	});
+	std::copy(current.begin(), current.end(), cubes);
+	return current.size();
+}
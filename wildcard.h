@@ -0,0 +1,10 @@
+#pragma once
+#include <cstddef>
+
+struct nm_wildcard
+{
+	unsigned address;
+	unsigned mask;
+};
+
+size_t nm_wildcard_merge(nm_wildcard*, size_t count);